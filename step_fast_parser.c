@@ -3,36 +3,310 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <glob.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 #include "step_protocol.h"
 
+/* 输出后端 */
+#define OUTPUT_BACKEND_URING    0   /* io_uring异步写 */
+#define OUTPUT_BACKEND_PWRITE   1   /* 同步pwrite (无io_uring的内核) */
+
+#define OUTPUT_ALIGN        4096                /* O_DIRECT缓冲区/偏移对齐 */
+#define OUTPUT_BLOCK_SIZE   (1024 * 1024)       /* 默认输出块1MB */
+#define OUTPUT_RING_SLOTS   8                   /* 每个输出文件同时在用的块数 */
+#define OUTPUT_STAGE_SIZE   (64 * 1024)         /* 线程暂存区, 攒满后整段拷入输出块 */
+#define OUTPUT_QUEUE_DEPTH  64                  /* io_uring队列深度 */
+#define OUTPUT_PARTITION_STAGE_SIZE (16 * 1024) /* 按代码分区时每个代码的线程暂存区 */
+
+/* 线程绑定方式 */
+#define AFFINITY_NONE       0   /* 不绑定, 由调度器决定 */
+#define AFFINITY_CORE       1   /* 每个线程绑定一个CPU */
+#define AFFINITY_NODE       2   /* 每个线程绑定一个NUMA节点的全部CPU */
+
+#define MAX_NUMA_NODES      64
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+
+#define MIN_JOB_SIZE        (256 * 1024)    /* 小于此大小的输入合并成一个任务 */
+
+#define SYMBOL_TABLE_SIZE   65536           /* 代码字典槽位数, 2的幂 */
+#define SYMBOL_MAX_COUNT    (SYMBOL_TABLE_SIZE / 2) /* 最多登记的代码数, 控制装载率 */
+#define SYMBOL_CACHE_SIZE   256             /* 线程本地代码缓存, 2的幂 */
+#define SYMBOL_ID_OVERFLOW  0xFFFFFFFFu     /* 字典已满 */
+
+#define ARB_MAX_LINES       64              /* 仲裁模式最多的冗余线路数 */
+#define ARB_RANGE_MESSAGES  (256 * 1024)    /* 每个仲裁区间的消息数上限 */
+
+#define MARKET_DATA_CSV_HEADER \
+    "Symbol,BidPrice,BidSize,AskPrice,AskSize,LastPrice,LastSize,Volume,Timestamp,Exchange\n"
+
 /* 全局配置 */
 typedef struct {
     char        input_file[256];
     char        output_prefix[256];
     int         num_threads;
-    size_t      chunk_size;     /* 每个线程处理的块大小 */
+    size_t      chunk_size;     /* 任务的最大数据量, 大文件按此切分 */
     int         verbose;
+    int         io_backend;     /* 输出后端 OUTPUT_BACKEND_* */
+    int         direct_io;      /* 输出文件使用O_DIRECT */
+    size_t      output_block_size;  /* 输出块大小 */
+    int         affinity;       /* 线程绑定方式 AFFINITY_* */
+    int         map_populate;   /* 输入映射使用MAP_POPULATE预读 */
+    int         map_hugepage;   /* 输入映射使用透明大页 */
+    int         merge_output;   /* 批量模式下合并输出到一个文件 */
+    int         partition_by_symbol;    /* 每个代码输出一个文件 */
+    int         arbitrate;      /* 输入为同一行情的冗余线路, 合并去重 */
 } parser_config_t;
 
+/* CPU拓扑: 按NUMA节点分组的可用CPU */
+typedef struct {
+    int         num_nodes;                      /* 含可用CPU的节点数 */
+    int         node_id[MAX_NUMA_NODES];        /* 节点编号 */
+    cpu_set_t   node_cpus[MAX_NUMA_NODES];      /* 节点上本进程可用的CPU */
+    int         cpu_node[CPU_SETSIZE];          /* CPU所属节点编号 */
+} cpu_topology_t;
+
+/* io_uring提交/完成队列 (直接使用系统调用, 不依赖liburing) */
+typedef struct {
+    int                 fd;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ring;
+    void                *cq_ring;
+    size_t              sq_ring_sz;
+    size_t              cq_ring_sz;
+    size_t              sqes_sz;
+} uring_t;
+
+/* 输出I/O: 所有输出文件共用的提交队列和块缓冲池 */
+typedef struct {
+    int             backend;
+    size_t          block_size;
+    uring_t         ring;
+    unsigned        inflight;       /* 已提交未完成的写请求 */
+    int             reaper;         /* 有线程正在不持锁地等待完成事件 */
+    pthread_mutex_t ring_mutex;
+    /* 每个NUMA节点一个空闲块链表, next指针存放在块首; 最后一个给未绑定的线程 */
+    void            *free_blocks[MAX_NUMA_NODES + 1];
+    pthread_mutex_t pool_mutex;
+} output_io_t;
+
+struct output_writer;
+
+/* 输出块槽位: 槽位i依次承载第i, i+OUTPUT_RING_SLOTS, ...块 */
+typedef struct {
+    char                    *data;      /* 从缓冲池取得, 写完归还 */
+    int                     pool;       /* data所属的缓冲池 */
+    uint64_t                block_no;   /* 当前可填充的块号 (原子) */
+    size_t                  filled;     /* 已拷入的字节数 (原子) */
+    struct output_writer    *writer;
+} output_slot_t;
+
+/* 输出文件: 各线程用原子游标预留字节区间, 写满的块在偏移block_no*block_size处异步写出 */
+typedef struct output_writer {
+    output_io_t     *io;
+    int             fd;             /* 整块写入 (可能带O_DIRECT) */
+    int             tail_fd;        /* 最后不满一块的数据 */
+    int             direct;
+    size_t          block_size;
+    size_t          cursor;         /* 已预留的总字节数 (原子) */
+    output_slot_t   slots[OUTPUT_RING_SLOTS];
+    int             io_error;
+} output_writer_t;
+
+/* 每线程输出暂存区 */
+typedef struct {
+    output_writer_t *writer;
+    char            *buf;
+    size_t          used;
+    size_t          stage_size;     /* 攒满后整段写入writer */
+    int             node;           /* 所在线程绑定的NUMA节点, 未绑定为-1 */
+} output_stream_t;
+
+/* 代码字典项, 登记后不再改变 */
+typedef struct {
+    uint32_t        hash;
+    uint32_t        len;
+    char            name[];
+} symbol_entry_t;
+
+typedef struct {
+    symbol_entry_t  *entry;         /* NULL为空槽 (原子) */
+    uint32_t        id;             /* 编号+1, 0表示正在登记 (原子) */
+} symbol_slot_t;
+
+/* 代码字典: 无锁开放寻址哈希表, 代码第一次出现时分配连续编号 */
+typedef struct {
+    symbol_slot_t   *slots;
+    symbol_entry_t  **by_id;
+    uint32_t        count;          /* 已分配的编号数 (原子) */
+} symbol_table_t;
+
+typedef struct {
+    const symbol_entry_t *entry;
+    int             id;
+} symbol_cache_entry_t;
+
+/* 线程内某个代码的输出分区 */
+typedef struct {
+    output_stream_t stream;
+    size_t          messages;
+} symbol_partition_t;
+
+/* 输入文件 */
+typedef struct {
+    const char      *path;
+    const uint8_t   *data;          /* 只读映射 */
+    size_t          size;
+    char            output_path[512];   /* 分文件输出时的CSV文件 */
+    output_writer_t writer;
+    int             writer_state;   /* 0未打开, 1已打开, -1打开失败 */
+    pthread_mutex_t mutex;
+    int             pending_segments;   /* 尚未处理完的数据段 (原子) */
+    size_t          messages;       /* 解析出的消息数 (原子) */
+} input_file_t;
+
+/* 数据段: 输入文件中的一个区间 */
+typedef struct {
+    int             file_idx;
+    size_t          start;
+    size_t          end;
+} job_segment_t;
+
+/* 任务: 大文件的一个分块, 或一组连续的小文件 */
+typedef struct {
+    int             first_segment;
+    int             num_segments;
+} parse_job_t;
+
+/* 仲裁索引项: 一条行情消息 */
+typedef struct {
+    const uint8_t   *msg;
+    uint64_t        timestamp;
+    uint32_t        seq_num;
+} arb_entry_t;
+
+typedef struct {
+    arb_entry_t     *entries;
+    size_t          count;
+    size_t          cap;
+} arb_index_t;
+
+/* 缺口: 一段连续序列号, 缺失的线路集合相同且由同一条线路补上 */
+typedef struct {
+    uint64_t        first;
+    uint64_t        last;
+    uint64_t        missing;        /* 缺失该段的线路 (位图) */
+    int             supplier;       /* 补上该段的线路, -1表示所有线路都缺失 */
+} arb_gap_t;
+
+/* 建线路索引的任务: 把一个数据段拷入线路索引, 或整条线路排序去重 */
+typedef struct {
+    int             line;
+    int             segment;        /* -1表示整条线路 */
+    size_t          offset;         /* 数据段在线路索引中的位置 */
+    size_t          skip;           /* 跳过开头与上一数据段重复的序列号 */
+} arb_task_t;
+
+/* 仲裁区间: [lo, hi)内的序列号由一个线程处理 */
+typedef struct {
+    uint64_t        lo;
+    uint64_t        hi;
+    arb_gap_t       *gaps;
+    size_t          num_gaps;
+    size_t          gaps_cap;
+    size_t          selected[ARB_MAX_LINES];    /* 每条线路被选中的消息数 */
+} arb_range_t;
+
+/* A/B线路仲裁状态 */
+typedef struct {
+    arb_index_t     *segment_index; /* 阶段1: 每个数据段排序去重后的索引 */
+    arb_index_t     *lines;         /* 每条线路按序列号排序去重后的索引 */
+    arb_task_t      *tasks;
+    int             num_tasks;
+    int             next_task;      /* 下一个待领取的任务 (原子) */
+    arb_range_t     *ranges;
+    int             num_ranges;
+    int             next_range;     /* 下一个待领取的区间 (原子) */
+    uint64_t        min_seq;
+    uint64_t        max_seq;
+    
+    pthread_barrier_t barrier;      /* 两个阶段之间 */
+    pthread_mutex_t commit_mutex;   /* 区间按顺序写出 */
+    pthread_cond_t  commit_cond;
+    int             next_commit;
+} arbitration_t;
+
+/* 一次运行的全部输入和任务, 由线程池共享 */
+typedef struct {
+    parser_config_t *config;
+    input_file_t    *files;
+    int             num_files;
+    job_segment_t   *segments;
+    int             num_segments;
+    parse_job_t     *jobs;
+    int             num_jobs;
+    int             next_job;       /* 下一个待领取的任务 (原子) */
+    
+    output_io_t     io;
+    int             merged;         /* 所有输入合并输出到一个文件 */
+    output_writer_t merged_writer;
+    int             io_error;
+    
+    /* 按代码分区输出 */
+    int             partition;
+    symbol_table_t  symbols;
+    output_writer_t **symbol_writers;   /* 按编号索引, 第一次出现时打开 (原子) */
+    output_writer_t symbol_writer_failed;   /* 打开失败的代码指向这里 */
+    size_t          *symbol_messages;
+    int             symbol_overflow;    /* 已报告字典已满 (原子) */
+    pthread_mutex_t symbol_mutex;
+    
+    arbitration_t   *arb;           /* 仲裁模式 */
+    
+    /* 仲裁模式的线程全部创建成功后才开始工作, 否则已启动的线程直接退出 */
+    pthread_mutex_t start_mutex;
+    pthread_cond_t  start_cond;
+    int             start_state;    /* 0等待, 1开始, -1放弃 */
+} parse_batch_t;
+
 /* 线程上下文 */
 typedef struct {
     pthread_t       thread_id;
     int             thread_idx;
-    const uint8_t   *data_start;
-    const uint8_t   *data_end;
-    FILE            **csv_files;    /* 每个消息类型一个CSV文件 */
-    pthread_mutex_t *file_mutexes;  /* 文件写锁 */
+    parse_batch_t   *batch;
     
     /* 统计信息 */
     size_t          bytes_processed;
     size_t          messages_parsed;
     size_t          errors_found;
     
+    /* 线程放置 */
+    int             cpu;            /* 运行所在CPU */
+    int             node;           /* 绑定的NUMA节点, 未绑定为-1 */
+    double          elapsed;        /* 解析耗时(秒) */
+    
+    /* 按代码分区输出 */
+    symbol_cache_entry_t symbol_cache[SYMBOL_CACHE_SIZE];
+    symbol_partition_t **partitions;    /* 按代码编号索引 */
+    
     /* 指向全局配置 */
     parser_config_t *config;
 } thread_context_t;
@@ -53,12 +327,20 @@ static fast_field_def_t market_data_template[] = {
 };
 
 /* 解析FAST消息到CSV行 */
+/* 前进snprintf输出的长度; 被截断时停在缓冲区末尾的'\0'处, 行长度不会超过buffer_size - 1 */
+static inline void csv_advance(char **csv_ptr, const char *csv_end, int n) {
+    if (n < 0) n = 0;
+    if (n > csv_end - *csv_ptr - 1) n = csv_end - *csv_ptr - 1;
+    *csv_ptr += n;
+}
+
 static int parse_fast_message(const uint8_t *data, size_t len, 
                              char *csv_buffer, size_t buffer_size) {
     /* FAST解析状态机 */
     const uint8_t *ptr = data;
     const uint8_t *end = data + len;
     char *csv_ptr = csv_buffer;
+    const char *csv_end = csv_buffer + buffer_size;
     int field_count = 0;
     
     /* 检查模板ID */
@@ -90,8 +372,8 @@ static int parse_fast_message(const uint8_t *data, size_t len,
                     if (ptr < end) {
                         value = (value << 7) | *ptr++;
                     }
-                    csv_ptr += snprintf(csv_ptr, buffer_size - (csv_ptr - csv_buffer),
-                                       "%s%u", field_count > 0 ? "," : "", value);
+                    csv_advance(&csv_ptr, csv_end, snprintf(csv_ptr, csv_end - csv_ptr,
+                                       "%s%u", field_count > 0 ? "," : "", value));
                     break;
                 }
                 case FAST_STRING: {
@@ -107,9 +389,9 @@ static int parse_fast_message(const uint8_t *data, size_t len,
                     
                     /* 复制字符串 */
                     if (ptr + str_len <= end) {
-                        csv_ptr += snprintf(csv_ptr, buffer_size - (csv_ptr - csv_buffer),
+                        csv_advance(&csv_ptr, csv_end, snprintf(csv_ptr, csv_end - csv_ptr,
                                            "%s\"%.*s\"", field_count > 0 ? "," : "", 
-                                           str_len, ptr);
+                                           str_len, ptr));
                         ptr += str_len;
                     }
                     break;
@@ -119,8 +401,8 @@ static int parse_fast_message(const uint8_t *data, size_t len,
                     uint32_t mantissa = 0;
                     int8_t exponent = 0;
                     // ... 实际解码逻辑
-                    csv_ptr += snprintf(csv_ptr, buffer_size - (csv_ptr - csv_buffer),
-                                       "%s%.6f", field_count > 0 ? "," : "", 0.0);
+                    csv_advance(&csv_ptr, csv_end, snprintf(csv_ptr, csv_end - csv_ptr,
+                                       "%s%.6f", field_count > 0 ? "," : "", 0.0));
                     break;
                 }
                 default:
@@ -131,225 +413,2176 @@ static int parse_fast_message(const uint8_t *data, size_t len,
         field++;
     }
     
+    return csv_ptr - csv_buffer;  /* CSV行长度 */
+}
+
+/* 完整写入, 处理EINTR和部分写 */
+static int pwrite_full(int fd, const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/* 创建io_uring实例并映射队列 */
+static int uring_init(uring_t *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return -1;
+    
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+        if (r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_sz);
+        if (r->cq_ring != MAP_FAILED) munmap(r->cq_ring, r->cq_ring_sz);
+        if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_sz);
+        close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+    
+    r->sq_head = (unsigned *)((char *)r->sq_ring + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ring + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+    
     return 0;
 }
 
-/* 线程工作函数 */
-static void *parse_thread_func(void *arg) {
-    thread_context_t *ctx = (thread_context_t *)arg;
-    const uint8_t *ptr = ctx->data_start;
+static void uring_destroy(uring_t *r) {
+    if (r->fd < 0) return;
+    munmap(r->sqes, r->sqes_sz);
+    munmap(r->cq_ring, r->cq_ring_sz);
+    munmap(r->sq_ring, r->sq_ring_sz);
+    close(r->fd);
+    r->fd = -1;
+}
+
+/* 提交一个写请求, 不等待完成 */
+static int uring_submit_write(uring_t *r, int fd, const void *buf, size_t len,
+                              off_t offset, uint64_t user_data) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
     
-    printf("Thread %d: processing %ld bytes\n", 
-           ctx->thread_idx, ctx->data_end - ctx->data_start);
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
     
-    while (ptr < ctx->data_end) {
-        /* 查找STEP起始标记 */
-        while (ptr < ctx->data_end - sizeof(step_header_t) + 1) {
-            if (*(uint32_t*)ptr == STEP_START_TAG) {
-                break;
-            }
-            ptr++;
-        }
-        
-        if (ptr >= ctx->data_end - sizeof(step_header_t)) {
-            break;  /* 没有完整的消息头 */
-        }
-        
-        /* 解析STEP头 */
-        step_header_t *header = (step_header_t *)ptr;
-        
-        /* 验证消息完整性 */
-        if (ptr + header->msg_length > ctx->data_end) {
-            /* 消息不完整，可能跨块 */
-            break;
-        }
-        
-        /* 验证校验和 */
-        step_trailer_t *trailer = (step_trailer_t *)(ptr + header->msg_length - sizeof(step_trailer_t));
-        // 实际应该计算CRC32并验证
-        // uint32_t calc_crc = calculate_crc32(ptr, header->msg_length - sizeof(step_trailer_t));
-        
-        /* 提取FAST payload */
-        size_t fast_offset = sizeof(step_header_t);
-        size_t fast_length = header->msg_length - sizeof(step_header_t) - sizeof(step_trailer_t);
-        
-        if (fast_length > 0 && header->msg_type == STEP_MARKET_DATA) {
-            /* 解析FAST消息 */
-            char csv_line[MAX_CSV_LINE_LEN];
-            if (parse_fast_message(ptr + fast_offset, fast_length, 
-                                  csv_line, sizeof(csv_line)) == 0) {
-                
-                /* 写CSV文件 */
-                pthread_mutex_lock(&ctx->file_mutexes[0]);  /* 假设索引0是行情CSV */
-                fprintf(ctx->csv_files[0], "%s\n", csv_line);
-                pthread_mutex_unlock(&ctx->file_mutexes[0]);
-                
-                ctx->messages_parsed++;
-            } else {
-                ctx->errors_found++;
-            }
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    
+    while (syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            /* 撤销未被内核取走的请求 */
+            __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+            return -1;
         }
-        
-        ctx->bytes_processed += header->msg_length;
-        ptr += header->msg_length;
     }
+    return 0;
+}
+
+/* 取出一个完成事件, 队列为空返回0 */
+static int uring_peek_cqe(uring_t *r, uint64_t *user_data, int *res) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return 0;
     
-    return NULL;
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
 }
 
-/* 内存映射文件并创建线程 */
-int parse_step_file(parser_config_t *config) {
-    int fd = open(config->input_file, O_RDONLY);
-    if (fd < 0) {
-        fprintf(stderr, "Failed to open file: %s\n", strerror(errno));
-        return -1;
+/* 阻塞直到至少有一个完成事件 */
+static int uring_wait(uring_t *r) {
+    while (syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        if (errno != EINTR) return -1;
     }
+    return 0;
+}
+
+/* 检测内核是否支持io_uring */
+static int uring_available(void) {
+    uring_t r;
+    if (uring_init(&r, OUTPUT_QUEUE_DEPTH) < 0) return 0;
+    uring_destroy(&r);
+    return 1;
+}
+
+static int output_io_init(output_io_t *io, int backend, size_t block_size) {
+    memset(io, 0, sizeof(*io));
+    io->backend = backend;
+    io->block_size = block_size;
+    io->ring.fd = -1;
     
-    /* 获取文件大小 */
-    struct stat st;
-    fstat(fd, &st);
-    size_t file_size = st.st_size;
-    
-    /* 内存映射 */
-    uint8_t *file_data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (file_data == MAP_FAILED) {
-        fprintf(stderr, "mmap failed: %s\n", strerror(errno));
-        close(fd);
-        return -1;
+    if (io->backend == OUTPUT_BACKEND_URING && uring_init(&io->ring, OUTPUT_QUEUE_DEPTH) < 0) {
+        io->backend = OUTPUT_BACKEND_PWRITE;
+    }
+    pthread_mutex_init(&io->ring_mutex, NULL);
+    pthread_mutex_init(&io->pool_mutex, NULL);
+    return 0;
+}
+
+static void output_io_destroy(output_io_t *io) {
+    uring_destroy(&io->ring);
+    for (int pool = 0; pool <= MAX_NUMA_NODES; pool++) {
+        while (io->free_blocks[pool]) {
+            void *next = *(void **)io->free_blocks[pool];
+            free(io->free_blocks[pool]);
+            io->free_blocks[pool] = next;
+        }
     }
+    pthread_mutex_destroy(&io->ring_mutex);
+    pthread_mutex_destroy(&io->pool_mutex);
+}
+
+static inline int output_io_pool(int node) {
+    return (node >= 0 && node < MAX_NUMA_NODES) ? node : MAX_NUMA_NODES;
+}
+
+/*
+ * 从调用线程所在节点的缓冲池取一个对齐的输出块. 池空时新分配,
+ * 已绑定的线程先整块触碰一遍, 使物理页落在本地节点.
+ */
+static char *output_io_get_block(output_io_t *io, int pool) {
+    void *block;
     
-    close(fd);
+    pthread_mutex_lock(&io->pool_mutex);
+    block = io->free_blocks[pool];
+    if (block) io->free_blocks[pool] = *(void **)block;
+    pthread_mutex_unlock(&io->pool_mutex);
     
-    /* 创建CSV文件 */
-    FILE *csv_files[1];  /* 简化：只创建行情CSV */
-    pthread_mutex_t file_mutexes[1];
+    if (!block) {
+        if (posix_memalign(&block, OUTPUT_ALIGN, io->block_size) != 0) return NULL;
+        if (pool != MAX_NUMA_NODES) memset(block, 0, io->block_size);
+    }
+    return block;
+}
+
+/* 归还到块原来所在节点的缓冲池 */
+static void output_io_put_block(output_io_t *io, char *block, int pool) {
+    pthread_mutex_lock(&io->pool_mutex);
+    *(void **)block = io->free_blocks[pool];
+    io->free_blocks[pool] = block;
+    pthread_mutex_unlock(&io->pool_mutex);
+}
+
+/* 块已落盘: 归还缓冲区, 槽位交给后面第OUTPUT_RING_SLOTS块 */
+static void output_slot_recycle(output_slot_t *slot) {
+    if (slot->data) output_io_put_block(slot->writer->io, slot->data, slot->pool);
+    slot->data = NULL;
+    slot->filled = 0;
+    __atomic_store_n(&slot->block_no, slot->block_no + OUTPUT_RING_SLOTS, __ATOMIC_RELEASE);
+}
+
+/* 处理一个完成事件, 短写或失败时同步补写 */
+static void output_slot_complete(output_slot_t *slot, int res) {
+    output_writer_t *w = slot->writer;
+    size_t done = res > 0 ? res : 0;
     
-    char csv_filename[256];
-    snprintf(csv_filename, sizeof(csv_filename), "%s_market_data.csv", 
-             config->output_prefix);
+    if (done < w->block_size &&
+        pwrite_full(w->fd, slot->data + done, w->block_size - done,
+                    slot->block_no * w->block_size + done) < 0) {
+        w->io_error = 1;
+    }
+    output_slot_recycle(slot);
+}
+
+/* 收割已有的完成事件. 调用者持有ring_mutex */
+static int output_io_reap_locked(output_io_t *io) {
+    uint64_t user_data;
+    int res;
+    int reaped = 0;
     
-    csv_files[0] = fopen(csv_filename, "w");
-    if (!csv_files[0]) {
-        fprintf(stderr, "Failed to create CSV file\n");
-        munmap(file_data, file_size);
-        return -1;
+    while (uring_peek_cqe(&io->ring, &user_data, &res)) {
+        output_slot_complete((output_slot_t *)(uintptr_t)user_data, res);
+        io->inflight--;
+        reaped++;
     }
+    return reaped;
+}
+
+/*
+ * 收割完成事件; wait非0且没有现成事件时阻塞等待. 等待时不持有ring_mutex,
+ * 其他线程照常提交. 同一时刻只有一个线程等待, 且等待期间其他线程不收割,
+ * 已提交的请求完成时等待的线程一定会被唤醒.
+ */
+static int output_io_reap(output_io_t *io, int wait) {
+    if (io->backend != OUTPUT_BACKEND_URING) return 0;
     
-    /* 写CSV头 */
-    fprintf(csv_files[0], "Symbol,BidPrice,BidSize,AskPrice,AskSize,LastPrice,LastSize,Volume,Timestamp,Exchange\n");
+    pthread_mutex_lock(&io->ring_mutex);
+    if (io->reaper) {
+        pthread_mutex_unlock(&io->ring_mutex);
+        return 0;
+    }
+    int reaped = output_io_reap_locked(io);
+    if (reaped || !wait || io->inflight == 0) {
+        pthread_mutex_unlock(&io->ring_mutex);
+        return reaped;
+    }
+    io->reaper = 1;
+    pthread_mutex_unlock(&io->ring_mutex);
     
-    pthread_mutex_init(&file_mutexes[0], NULL);
+    uring_wait(&io->ring);
     
-    /* 计算每个线程处理的数据块 */
-    size_t chunk_size = file_size / config->num_threads;
-    thread_context_t *threads = calloc(config->num_threads, sizeof(thread_context_t));
+    pthread_mutex_lock(&io->ring_mutex);
+    reaped = output_io_reap_locked(io);
+    io->reaper = 0;
+    pthread_mutex_unlock(&io->ring_mutex);
+    return reaped;
+}
+
+/* 提交一个写满的块 */
+static void output_slot_submit(output_slot_t *slot) {
+    output_writer_t *w = slot->writer;
+    output_io_t *io = w->io;
     
-    /* 创建线程 */
-    for (int i = 0; i < config->num_threads; i++) {
-        threads[i].thread_idx = i;
-        threads[i].config = config;
-        threads[i].csv_files = csv_files;
-        threads[i].file_mutexes = file_mutexes;
-        
-        /* 分配数据块 */
-        threads[i].data_start = file_data + i * chunk_size;
-        
-        /* 调整起始点，避免截断消息 */
-        if (i > 0) {
-            /* 向前查找STEP起始标记 */
-            const uint8_t *adjust_ptr = threads[i].data_start;
-            const uint8_t *search_start = adjust_ptr - sizeof(step_header_t) * 2;
-            if (search_start < file_data) search_start = file_data;
-            
-            while (adjust_ptr >= search_start) {
-                if (*(uint32_t*)adjust_ptr == STEP_START_TAG) {
-                    threads[i].data_start = adjust_ptr;
-                    break;
-                }
-                adjust_ptr--;
-            }
+    /* 所有线程都没能取得缓冲区, io_error已置位, 直接轮转槽位 */
+    if (!slot->data) {
+        output_slot_recycle(slot);
+        return;
+    }
+    
+    if (io->backend == OUTPUT_BACKEND_URING) {
+        pthread_mutex_lock(&io->ring_mutex);
+        /* 顺便收割已完成的请求, 防止完成队列溢出; 有线程在等待时由它收割 */
+        if (!io->reaper) output_io_reap_locked(io);
+        while (io->inflight >= OUTPUT_QUEUE_DEPTH) {
+            pthread_mutex_unlock(&io->ring_mutex);
+            if (!output_io_reap(io, 1)) sched_yield();
+            pthread_mutex_lock(&io->ring_mutex);
         }
+        int ret = uring_submit_write(&io->ring, w->fd, slot->data, w->block_size,
+                                     slot->block_no * w->block_size,
+                                     (uint64_t)(uintptr_t)slot);
+        if (ret == 0) io->inflight++;
+        pthread_mutex_unlock(&io->ring_mutex);
+        if (ret == 0) return;
+    }
+    output_slot_complete(slot, -1);
+}
+
+/* 追加数据: 预留文件区间后拷入对应的块, 写满的块立即提交. node为调用线程绑定的节点 */
+static void output_writer_write(output_writer_t *w, const char *data, size_t len, int node) {
+    size_t offset = __atomic_fetch_add(&w->cursor, len, __ATOMIC_RELAXED);
+    
+    while (len > 0) {
+        uint64_t block_no = offset / w->block_size;
+        size_t in_block = offset % w->block_size;
+        size_t piece = w->block_size - in_block;
+        if (piece > len) piece = len;
         
-        /* 设置结束点 */
-        if (i == config->num_threads - 1) {
-            threads[i].data_end = file_data + file_size;
-        } else {
-            threads[i].data_end = file_data + (i + 1) * chunk_size;
-            
-            /* 向后调整到完整消息边界 */
-            const uint8_t *ptr = threads[i].data_end;
-            const uint8_t *search_end = ptr + sizeof(step_header_t) * 2;
-            if (search_end > file_data + file_size) search_end = file_data + file_size;
-            
-            while (ptr < search_end) {
-                if (*(uint32_t*)ptr == STEP_START_TAG) {
-                    threads[i].data_end = ptr;
-                    break;
-                }
-                ptr++;
+        /* 等待槽位上一轮的块写完 */
+        output_slot_t *slot = &w->slots[block_no % OUTPUT_RING_SLOTS];
+        while (__atomic_load_n(&slot->block_no, __ATOMIC_ACQUIRE) != block_no) {
+            if (!output_io_reap(w->io, 1)) sched_yield();
+        }
+        
+        char *block = __atomic_load_n(&slot->data, __ATOMIC_ACQUIRE);
+        if (!block) {
+            int pool = output_io_pool(node);
+            char *fresh = output_io_get_block(w->io, pool);
+            if (!fresh) {
+                w->io_error = 1;
+            } else if (__atomic_compare_exchange_n(&slot->data, &block, fresh, 0,
+                                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                /* 在本线程累加filled之前写入, 提交和回收的线程能看到 */
+                slot->pool = pool;
+                block = fresh;
+            } else {
+                output_io_put_block(w->io, fresh, pool);
             }
         }
         
-        /* 创建线程 */
-        pthread_create(&threads[i].thread_id, NULL, parse_thread_func, &threads[i]);
+        /* 取不到缓冲区时丢弃这段数据, 但仍计入filled, 让该块照常轮转, 等待该槽位的线程不会卡住 */
+        if (block) memcpy(block + in_block, data, piece);
+        if (__atomic_add_fetch(&slot->filled, piece, __ATOMIC_ACQ_REL) == w->block_size) {
+            output_slot_submit(slot);
+        }
+        
+        data += piece;
+        len -= piece;
+        offset += piece;
     }
+}
+
+/* 打开输出文件并写入CSV头 */
+static int output_writer_open(output_writer_t *w, output_io_t *io, const char *path,
+                              const char *header, int direct) {
+    memset(w, 0, sizeof(*w));
+    w->io = io;
+    w->block_size = io->block_size;
+    w->fd = -1;
     
-    /* 等待线程完成 */
-    size_t total_bytes = 0;
-    size_t total_messages = 0;
-    
-    for (int i = 0; i < config->num_threads; i++) {
-        pthread_join(threads[i].thread_id, NULL);
-        
-        total_bytes += threads[i].bytes_processed;
-        total_messages += threads[i].messages_parsed;
-        
-        if (config->verbose) {
-            printf("Thread %d: processed %ld bytes, %ld messages, %ld errors\n",
-                   i, threads[i].bytes_processed, 
-                   threads[i].messages_parsed, threads[i].errors_found);
+    if (direct) {
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (w->fd < 0 && errno == EINVAL) {
+            fprintf(stderr, "O_DIRECT not supported for %s, using buffered writes\n", path);
+        } else if (w->fd >= 0) {
+            w->tail_fd = open(path, O_WRONLY);
+            if (w->tail_fd < 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+                close(w->fd);
+                return -1;
+            }
+            w->direct = 1;
         }
     }
     
-    printf("\nTotal: %ld bytes, %ld messages parsed\n", total_bytes, total_messages);
-    
-    /* 清理资源 */
-    for (int i = 0; i < 1; i++) {
-        fclose(csv_files[i]);
-        pthread_mutex_destroy(&file_mutexes[i]);
+    if (!w->direct) {
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        w->tail_fd = w->fd;
+    }
+    if (w->fd < 0) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return -1;
     }
     
-    munmap(file_data, file_size);
-    free(threads);
+    for (int i = 0; i < OUTPUT_RING_SLOTS; i++) {
+        w->slots[i].block_no = i;
+        w->slots[i].writer = w;
+    }
     
+    output_writer_write(w, header, strlen(header), -1);
     return 0;
 }
 
-/* 主函数 */
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <input_file> <output_prefix> [num_threads]\n", argv[0]);
-        return 1;
+/* 等待所有块写完, 写出最后不满一块的数据并关闭文件 */
+static int output_writer_close(output_writer_t *w) {
+    uint64_t last_block = w->cursor / w->block_size;
+    size_t last_len = w->cursor % w->block_size;
+    
+    for (uint64_t b = last_block > OUTPUT_RING_SLOTS ? last_block - OUTPUT_RING_SLOTS : 0;
+         b < last_block; b++) {
+        output_slot_t *slot = &w->slots[b % OUTPUT_RING_SLOTS];
+        while (__atomic_load_n(&slot->block_no, __ATOMIC_ACQUIRE) == b) {
+            if (!output_io_reap(w->io, 1)) sched_yield();
+        }
     }
     
-    parser_config_t config = {
-        .num_threads = 4,  /* 默认4线程 */
-        .chunk_size = 64 * 1024 * 1024,  /* 64MB块 */
-        .verbose = 1
-    };
+    output_slot_t *slot = &w->slots[last_block % OUTPUT_RING_SLOTS];
+    if (last_len > 0 && slot->data) {
+        if (pwrite_full(w->tail_fd, slot->data, last_len, last_block * w->block_size) < 0) {
+            w->io_error = 1;
+        }
+    }
+    if (slot->data) output_io_put_block(w->io, slot->data, slot->pool);
     
-    strncpy(config.input_file, argv[1], sizeof(config.input_file) - 1);
-    strncpy(config.output_prefix, argv[2], sizeof(config.output_prefix) - 1);
+    if (w->tail_fd != w->fd) close(w->tail_fd);
+    close(w->fd);
+    
+    if (w->io_error) {
+        fprintf(stderr, "Output write failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int output_stream_init(output_stream_t *s, output_writer_t *w, size_t stage_size,
+                              int node) {
+    s->writer = w;
+    s->used = 0;
+    s->stage_size = stage_size;
+    s->node = node;
+    s->buf = malloc(stage_size + MAX_CSV_LINE_LEN);
+    return s->buf ? 0 : -1;
+}
+
+/* 当前可写位置, 保证至少有MAX_CSV_LINE_LEN字节空间 */
+static inline char *output_stream_ptr(output_stream_t *s) {
+    return s->buf + s->used;
+}
+
+static inline void output_stream_commit(output_stream_t *s, size_t len) {
+    s->used += len;
+    if (s->used >= s->stage_size) {
+        output_writer_write(s->writer, s->buf, s->used, s->node);
+        s->used = 0;
+    }
+}
+
+/* 暂存数据写入当前输出文件 */
+static void output_stream_flush(output_stream_t *s) {
+    if (s->used > 0) {
+        output_writer_write(s->writer, s->buf, s->used, s->node);
+        s->used = 0;
+    }
+}
+
+/* 切换输出文件 */
+static void output_stream_bind(output_stream_t *s, output_writer_t *w) {
+    if (s->writer != w) {
+        output_stream_flush(s);
+        s->writer = w;
+    }
+}
+
+static void output_stream_release(output_stream_t *s) {
+    output_stream_flush(s);
+    free(s->buf);
+    s->buf = NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 解析sysfs的cpulist格式, 如 "0-3,8-11" */
+static void parse_cpulist(const char *list, cpu_set_t *set) {
+    const char *p = list;
+    CPU_ZERO(set);
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if (*p == ',') p++;
+        else break;
+    }
+}
+
+/* 读取NUMA拓扑, 只保留本进程允许使用的CPU */
+static void topology_load(cpu_topology_t *topo) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
     
-    if (argc >= 4) {
-        config.num_threads = atoi(argv[3]);
-        if (config.num_threads <= 0) config.num_threads = 4;
+    memset(topo, 0, sizeof(*topo));
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        char path[128];
+        char list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        if (!fgets(list, sizeof(list), fp)) list[0] = '\0';
+        fclose(fp);
+        
+        cpu_set_t cpus;
+        parse_cpulist(list, &cpus);
+        CPU_AND(&cpus, &cpus, &allowed);
+        if (CPU_COUNT(&cpus) == 0) continue;  /* 纯内存节点或不可用 */
+        
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &cpus)) topo->cpu_node[cpu] = node;
+        }
+        topo->node_id[topo->num_nodes] = node;
+        topo->node_cpus[topo->num_nodes] = cpus;
+        topo->num_nodes++;
     }
     
-    printf("Starting STEP/FAST parser:\n");
-    printf("  Input file: %s\n", config.input_file);
-    printf("  Output prefix: %s\n", config.output_prefix);
-    printf("  Threads: %d\n", config.num_threads);
+    /* 没有NUMA信息时视为单节点 */
+    if (topo->num_nodes == 0) {
+        topo->node_id[0] = 0;
+        topo->node_cpus[0] = allowed;
+        topo->num_nodes = 1;
+    }
+}
+
+/* 计算第idx个线程的CPU集合: 线程轮流分布到各节点, 节点内依次取CPU */
+static int topology_place(const cpu_topology_t *topo, int mode, int idx, cpu_set_t *set) {
+    int n = idx % topo->num_nodes;
+    const cpu_set_t *node_cpus = &topo->node_cpus[n];
     
-    return parse_step_file(&config);
-}
\ No newline at end of file
+    if (mode == AFFINITY_NODE) {
+        *set = *node_cpus;
+    } else {
+        int k = (idx / topo->num_nodes) % CPU_COUNT(node_cpus);
+        CPU_ZERO(set);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, node_cpus) && k-- == 0) {
+                CPU_SET(cpu, set);
+                break;
+            }
+        }
+    }
+    return topo->node_id[n];
+}
+
+/* 映射输入文件, 按配置预读和启用透明大页 */
+static uint8_t *map_input_file(int fd, size_t file_size, const parser_config_t *config) {
+    int flags = MAP_PRIVATE | (config->map_populate ? MAP_POPULATE : 0);
+    void *addr = NULL;
+    
+    if (config->map_hugepage) {
+        /* 预留2MB对齐的地址, 大页要求虚拟地址对齐 */
+        size_t map_len = (file_size + 4095) & ~(size_t)4095;
+        size_t reserve_len = map_len + HUGE_PAGE_SIZE;
+        uint8_t *reserve = mmap(NULL, reserve_len, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserve != MAP_FAILED) {
+            uint8_t *aligned = (uint8_t *)(((uintptr_t)reserve + HUGE_PAGE_SIZE - 1) &
+                                           ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+            if (aligned > reserve) munmap(reserve, aligned - reserve);
+            munmap(aligned + map_len, reserve + reserve_len - (aligned + map_len));
+            addr = aligned;
+            flags |= MAP_FIXED;
+        }
+    }
+    
+    uint8_t *data = mmap(addr, file_size, PROT_READ, flags, fd, 0);
+    if (data == MAP_FAILED) return NULL;
+    
+    /* 各线程顺序扫描自己的数据块, 加大预读 */
+    madvise(data, file_size, MADV_SEQUENTIAL);
+    
+    if (config->map_hugepage && madvise(data, file_size, MADV_HUGEPAGE) < 0) {
+        fprintf(stderr, "MADV_HUGEPAGE failed: %s\n", strerror(errno));
+    }
+    return data;
+}
+
+/* 读取FAST变长无符号整数 */
+static inline uint32_t fast_read_uint(const uint8_t **pp, const uint8_t *end) {
+    const uint8_t *ptr = *pp;
+    uint32_t value = 0;
+    while (ptr < end && (*ptr & 0x80)) {
+        value = (value << 7) | (*ptr & 0x7F);
+        ptr++;
+    }
+    if (ptr < end) {
+        value = (value << 7) | *ptr++;
+    }
+    *pp = ptr;
+    return value;
+}
+
+/* 取出行情消息的Symbol字段(模板第一个字段), 字段不存在或越界时为空串, 与parse_fast_message一致 */
+static int fast_peek_symbol(const uint8_t *data, size_t len,
+                            const char **symbol, uint32_t *symbol_len) {
+    const uint8_t *ptr = data;
+    const uint8_t *end = data + len;
+    
+    if (ptr + 2 > end || ptr[0] != FAST_TEMPLATE_ID) return -1;
+    uint8_t presence_map = ptr[1];
+    ptr += 2;
+    
+    *symbol = "";
+    *symbol_len = 0;
+    if (!(presence_map & FAST_PRESENCE_MAP)) return 0;
+    
+    uint32_t str_len = fast_read_uint(&ptr, end);
+    if (ptr + str_len > end) return 0;
+    *symbol = (const char *)ptr;
+    *symbol_len = str_len;
+    return 0;
+}
+
+/* FNV-1a */
+static inline uint32_t symbol_hash(const char *name, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int symbol_table_init(symbol_table_t *table) {
+    memset(table, 0, sizeof(*table));
+    table->slots = calloc(SYMBOL_TABLE_SIZE, sizeof(symbol_slot_t));
+    table->by_id = calloc(SYMBOL_MAX_COUNT, sizeof(symbol_entry_t *));
+    return (table->slots && table->by_id) ? 0 : -1;
+}
+
+static void symbol_table_destroy(symbol_table_t *table) {
+    if (table->slots) {
+        for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+            free(table->slots[i].entry);
+        }
+    }
+    free(table->slots);
+    free(table->by_id);
+}
+
+/*
+ * 查找或登记代码, 返回编号. 无锁开放寻址: 用CAS抢占空槽,
+ * 抢到的线程分配编号后发布; 同时遇到该槽的线程等待编号发布.
+ */
+static int symbol_table_intern(symbol_table_t *table, const char *name, uint32_t len,
+                               uint32_t hash, const symbol_entry_t **entry_out) {
+    symbol_entry_t *mine = NULL;
+    
+    for (uint32_t i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        symbol_slot_t *slot = &table->slots[(hash + i) & (SYMBOL_TABLE_SIZE - 1)];
+        symbol_entry_t *entry = __atomic_load_n(&slot->entry, __ATOMIC_ACQUIRE);
+        
+        if (!entry) {
+            if (!mine) {
+                mine = malloc(sizeof(symbol_entry_t) + len + 1);
+                if (!mine) return -1;
+                mine->hash = hash;
+                mine->len = len;
+                memcpy(mine->name, name, len);
+                mine->name[len] = '\0';
+            }
+            if (__atomic_compare_exchange_n(&slot->entry, &entry, mine, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                uint32_t id = __atomic_fetch_add(&table->count, 1, __ATOMIC_RELAXED);
+                if (id >= SYMBOL_MAX_COUNT) {
+                    __atomic_store_n(&slot->id, SYMBOL_ID_OVERFLOW, __ATOMIC_RELEASE);
+                    return -1;
+                }
+                table->by_id[id] = mine;
+                __atomic_store_n(&slot->id, id + 1, __ATOMIC_RELEASE);
+                *entry_out = mine;
+                return id;
+            }
+            /* 被其他线程抢先, entry为其登记的代码 */
+        }
+        
+        if (entry->hash == hash && entry->len == len && memcmp(entry->name, name, len) == 0) {
+            uint32_t id;
+            while ((id = __atomic_load_n(&slot->id, __ATOMIC_ACQUIRE)) == 0) {
+                sched_yield();
+            }
+            free(mine);
+            if (id == SYMBOL_ID_OVERFLOW) return -1;
+            *entry_out = entry;
+            return id - 1;
+        }
+    }
+    
+    free(mine);
+    return -1;
+}
+
+/* 线程本地缓存命中时不访问共享字典 */
+static int symbol_lookup(thread_context_t *ctx, const char *name, uint32_t len) {
+    uint32_t hash = symbol_hash(name, len);
+    symbol_cache_entry_t *c = &ctx->symbol_cache[hash & (SYMBOL_CACHE_SIZE - 1)];
+    
+    if (c->entry && c->entry->hash == hash && c->entry->len == len &&
+        memcmp(c->entry->name, name, len) == 0) {
+        return c->id;
+    }
+    
+    const symbol_entry_t *entry;
+    int id = symbol_table_intern(&ctx->batch->symbols, name, len, hash, &entry);
+    if (id >= 0) {
+        c->entry = entry;
+        c->id = id;
+    }
+    return id;
+}
+
+/*
+ * 代码输出文件名: <前缀>_<代码>_market_data.csv. 字母, 数字和"._-"原样保留,
+ * 其他字节编码为%XX, 保证不同代码对应不同文件 (BRK/A -> BRK%2FA, BRK_A不变).
+ * 编码后过长的代码截断并加上"%#编号", 空代码为"%NOSYMBOL"; 正常编码不会产生这两种形式.
+ */
+static void make_symbol_output_path(char *buf, size_t size, const char *prefix,
+                                    const symbol_entry_t *entry, int id) {
+    static const char hex[] = "0123456789ABCDEF";
+    char name[128];
+    uint32_t n = 0;
+    uint32_t i;
+    
+    for (i = 0; i < entry->len && n + 3 < sizeof(name) - 16; i++) {
+        unsigned char ch = entry->name[i];
+        int safe = (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') ||
+                   (ch >= '0' && ch <= '9') || ch == '.' || ch == '-' || ch == '_';
+        if (safe) {
+            name[n++] = ch;
+        } else {
+            name[n++] = '%';
+            name[n++] = hex[ch >> 4];
+            name[n++] = hex[ch & 15];
+        }
+    }
+    if (i < entry->len) {
+        n += snprintf(name + n, sizeof(name) - n, "%%#%d", id);
+    }
+    name[n] = '\0';
+    snprintf(buf, size, "%s_%s_market_data.csv", prefix, entry->len > 0 ? name : "%NOSYMBOL");
+}
+
+/* 取得代码的输出文件, 第一次出现时打开 */
+static output_writer_t *symbol_writer(parse_batch_t *batch, int id) {
+    output_writer_t *w = __atomic_load_n(&batch->symbol_writers[id], __ATOMIC_ACQUIRE);
+    if (w) return w != &batch->symbol_writer_failed ? w : NULL;
+    
+    pthread_mutex_lock(&batch->symbol_mutex);
+    w = batch->symbol_writers[id];
+    if (w == &batch->symbol_writer_failed) {
+        w = NULL;
+    } else if (!w) {
+        char path[512];
+        make_symbol_output_path(path, sizeof(path), batch->config->output_prefix,
+                                batch->symbols.by_id[id], id);
+        w = malloc(sizeof(output_writer_t));
+        if (w && output_writer_open(w, &batch->io, path, MARKET_DATA_CSV_HEADER,
+                                    batch->config->direct_io) < 0) {
+            free(w);
+            w = NULL;
+        }
+        /* 打开失败也记下来, 该代码后续的消息不再重试和报错 */
+        __atomic_store_n(&batch->symbol_writers[id], w ? w : &batch->symbol_writer_failed,
+                         __ATOMIC_RELEASE);
+        if (!w) batch->io_error = 1;
+    }
+    pthread_mutex_unlock(&batch->symbol_mutex);
+    return w;
+}
+
+/* 当前线程该消息代码的分区暂存区 */
+static symbol_partition_t *symbol_partition(thread_context_t *ctx,
+                                            const uint8_t *payload, size_t len) {
+    const char *name;
+    uint32_t name_len;
+    
+    /* 模板不符的消息解析同样会失败, 与不分区时一样只计入errors_found */
+    if (fast_peek_symbol(payload, len, &name, &name_len) < 0) return NULL;
+    
+    /* 字典已满时后来的代码无处输出, 整个运行以失败结束 */
+    int id = symbol_lookup(ctx, name, name_len);
+    if (id < 0) {
+        if (!__atomic_exchange_n(&ctx->batch->symbol_overflow, 1, __ATOMIC_RELAXED)) {
+            fprintf(stderr, "Symbol dictionary full (%d symbols) or out of memory, "
+                    "dropping messages of further symbols\n", SYMBOL_MAX_COUNT);
+        }
+        ctx->batch->io_error = 1;
+        return NULL;
+    }
+    
+    symbol_partition_t *part = ctx->partitions[id];
+    if (!part) {
+        output_writer_t *w = symbol_writer(ctx->batch, id);
+        part = calloc(1, sizeof(symbol_partition_t));
+        if (!w || !part || output_stream_init(&part->stream, w, OUTPUT_PARTITION_STAGE_SIZE,
+                                                ctx->node) < 0) {
+            free(part);
+            ctx->batch->io_error = 1;
+            return NULL;
+        }
+        ctx->partitions[id] = part;
+    }
+    return part;
+}
+
+/* 线程结束: 写出各分区剩余数据, 累计每个代码的消息数 */
+static void symbol_partitions_release(thread_context_t *ctx) {
+    uint32_t count = __atomic_load_n(&ctx->batch->symbols.count, __ATOMIC_ACQUIRE);
+    if (count > SYMBOL_MAX_COUNT) count = SYMBOL_MAX_COUNT;
+    
+    for (uint32_t id = 0; id < count; id++) {
+        symbol_partition_t *part = ctx->partitions[id];
+        if (!part) continue;
+        output_stream_release(&part->stream);
+        __atomic_add_fetch(&ctx->batch->symbol_messages[id], part->messages, __ATOMIC_RELAXED);
+        free(part);
+    }
+    free(ctx->partitions);
+}
+
+/* 写出带引号的CSV字段, 内嵌的引号写两遍; 逗号和换行在引号内原样保留 */
+static void write_csv_quoted(FILE *fp, const char *str, size_t len) {
+    fputc('"', fp);
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '"') fputc('"', fp);
+        fputc(str[i], fp);
+    }
+    fputc('"', fp);
+}
+
+/* 关闭全部代码输出, 写出代码字典 */
+static int symbol_outputs_close(parse_batch_t *batch) {
+    int ret = 0;
+    uint32_t count = batch->symbols.count;
+    if (count > SYMBOL_MAX_COUNT) count = SYMBOL_MAX_COUNT;
+    
+    char path[512];
+    snprintf(path, sizeof(path), "%s_symbols.csv", batch->config->output_prefix);
+    FILE *fp = fopen(path, "w");
+    if (fp) {
+        fprintf(fp, "SymbolId,Symbol,Messages,File\n");
+    } else {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        ret = -1;
+    }
+    
+    for (uint32_t id = 0; id < count; id++) {
+        const symbol_entry_t *entry = batch->symbols.by_id[id];
+        if (batch->symbol_writers[id] && batch->symbol_writers[id] != &batch->symbol_writer_failed) {
+            if (output_writer_close(batch->symbol_writers[id]) < 0) ret = -1;
+            free(batch->symbol_writers[id]);
+        }
+        if (fp) {
+            char file[512];
+            make_symbol_output_path(file, sizeof(file), batch->config->output_prefix,
+                                    entry, id);
+            fprintf(fp, "%u,", id);
+            write_csv_quoted(fp, entry->name, entry->len);
+            fprintf(fp, ",%zu,", batch->symbol_messages[id]);
+            write_csv_quoted(fp, file, strlen(file));
+            fputc('\n', fp);
+        }
+    }
+    
+    if (fp) fclose(fp);
+    if (batch->config->verbose) {
+        printf("Symbols: %u partitions, dictionary %s\n", count, path);
+    }
+    return ret;
+}
+
+/* 线程入口处等待启动, 返回0表示放弃本次运行 */
+static int batch_wait_start(parse_batch_t *batch) {
+    pthread_mutex_lock(&batch->start_mutex);
+    while (batch->start_state == 0) {
+        pthread_cond_wait(&batch->start_cond, &batch->start_mutex);
+    }
+    int state = batch->start_state;
+    pthread_mutex_unlock(&batch->start_mutex);
+    return state > 0;
+}
+
+static void batch_start(parse_batch_t *batch, int state) {
+    pthread_mutex_lock(&batch->start_mutex);
+    batch->start_state = state;
+    pthread_cond_broadcast(&batch->start_cond);
+    pthread_mutex_unlock(&batch->start_mutex);
+}
+
+/* 从*pp开始查找下一条完整的STEP消息, 起始位置须在end之前, 消息可延伸到limit */
+static const step_header_t *next_step_message(const uint8_t **pp, const uint8_t *end,
+                                              const uint8_t *limit) {
+    const uint8_t *ptr = *pp;
+    
+    while (ptr < end) {
+        /* 查找STEP起始标记 */
+        while (ptr < end && ptr + sizeof(step_header_t) <= limit) {
+            if (*(uint32_t*)ptr == STEP_START_TAG) {
+                break;
+            }
+            ptr++;
+        }
+        
+        if (ptr >= end || ptr + sizeof(step_header_t) > limit) {
+            break;  /* 没有完整的消息头 */
+        }
+        
+        /* 解析STEP头 */
+        const step_header_t *header = (const step_header_t *)ptr;
+        
+        /* 长度不足以容纳头尾, 是数据中偶然出现的起始标记 */
+        if (header->msg_length < sizeof(step_header_t) + sizeof(step_trailer_t)) {
+            ptr++;
+            continue;
+        }
+        
+        /* 验证消息完整性 */
+        if (ptr + header->msg_length > limit) {
+            /* 文件末尾的消息不完整 */
+            break;
+        }
+        
+        *pp = ptr;
+        return header;
+    }
+    
+    *pp = ptr;
+    return NULL;
+}
+
+/* 解析一个数据段: 处理起始位置落在[start, end)内的消息, 最后一条消息可越过end直到limit */
+static void parse_segment(thread_context_t *ctx, const uint8_t *start, const uint8_t *end,
+                          const uint8_t *limit, output_stream_t *out) {
+    const uint8_t *ptr = start;
+    const step_header_t *header;
+    
+    while ((header = next_step_message(&ptr, end, limit)) != NULL) {
+        /* 验证校验和 */
+        // 实际应该计算CRC32并验证
+        // uint32_t calc_crc = calculate_crc32(ptr, header->msg_length - sizeof(step_trailer_t));
+        
+        /* 提取FAST payload */
+        size_t fast_offset = sizeof(step_header_t);
+        size_t fast_length = header->msg_length - sizeof(step_header_t) - sizeof(step_trailer_t);
+        
+        if (fast_length > 0 && header->msg_type == STEP_MARKET_DATA) {
+            /* 按代码分区时写入该代码的暂存区 */
+            output_stream_t *stream = out;
+            symbol_partition_t *part = NULL;
+            if (ctx->batch->partition) {
+                part = symbol_partition(ctx, ptr + fast_offset, fast_length);
+                stream = part ? &part->stream : NULL;
+            }
+            
+            /* 解析FAST消息, 直接写入输出缓冲区 */
+            int csv_len = -1;
+            char *csv_line = NULL;
+            if (stream) {
+                csv_line = output_stream_ptr(stream);
+                csv_len = parse_fast_message(ptr + fast_offset, fast_length,
+                                             csv_line, MAX_CSV_LINE_LEN - 1);
+            }
+            if (csv_len >= 0) {
+                csv_line[csv_len] = '\n';
+                output_stream_commit(stream, csv_len + 1);
+                
+                ctx->messages_parsed++;
+                if (part) part->messages++;
+            } else {
+                ctx->errors_found++;
+            }
+        }
+        
+        ctx->bytes_processed += header->msg_length;
+        ptr += header->msg_length;
+    }
+}
+
+/* 取得输入文件对应的输出, 分文件输出时在第一个数据段开始时打开 */
+static output_writer_t *input_file_writer(parse_batch_t *batch, input_file_t *file) {
+    if (batch->merged) {
+        return &batch->merged_writer;
+    }
+    
+    pthread_mutex_lock(&file->mutex);
+    if (file->writer_state == 0) {
+        file->writer_state = output_writer_open(&file->writer, &batch->io, file->output_path,
+                                                MARKET_DATA_CSV_HEADER,
+                                                batch->config->direct_io) == 0 ? 1 : -1;
+        /* 该输入不会被解析, 整个运行以失败结束 */
+        if (file->writer_state < 0) batch->io_error = 1;
+    }
+    pthread_mutex_unlock(&file->mutex);
+    
+    return file->writer_state > 0 ? &file->writer : NULL;
+}
+
+/* 数据段处理完毕, 文件的最后一个数据段负责关闭其输出 */
+static void input_file_segment_done(parse_batch_t *batch, input_file_t *file, size_t messages) {
+    __atomic_add_fetch(&file->messages, messages, __ATOMIC_RELAXED);
+    
+    if (__atomic_sub_fetch(&file->pending_segments, 1, __ATOMIC_ACQ_REL) == 0 &&
+        !batch->merged && file->writer_state > 0) {
+        if (output_writer_close(&file->writer) < 0) {
+            batch->io_error = 1;
+        }
+    }
+}
+
+/* 线程工作函数: 从共享任务表中依次领取任务, 直到全部完成 */
+static void *parse_thread_func(void *arg) {
+    thread_context_t *ctx = (thread_context_t *)arg;
+    parse_batch_t *batch = ctx->batch;
+    output_stream_t out;
+    double start_time = now_seconds();
+    
+    /* 在绑定后的线程内分配并触碰暂存区, 使其落在本地节点 */
+    if (output_stream_init(&out, NULL, OUTPUT_STAGE_SIZE, ctx->node) < 0 ||
+        (batch->partition &&
+         !(ctx->partitions = calloc(SYMBOL_MAX_COUNT, sizeof(symbol_partition_t *))))) {
+        fprintf(stderr, "Thread %d: failed to allocate output buffers\n", ctx->thread_idx);
+        batch->io_error = 1;
+        return NULL;
+    }
+    memset(out.buf, 0, OUTPUT_STAGE_SIZE + MAX_CSV_LINE_LEN);
+    
+    for (;;) {
+        int job_idx = __atomic_fetch_add(&batch->next_job, 1, __ATOMIC_RELAXED);
+        if (job_idx >= batch->num_jobs) break;
+        
+        parse_job_t *job = &batch->jobs[job_idx];
+        for (int i = 0; i < job->num_segments; i++) {
+            job_segment_t *seg = &batch->segments[job->first_segment + i];
+            input_file_t *file = &batch->files[seg->file_idx];
+            size_t messages_before = ctx->messages_parsed;
+            
+            /* 按代码分区时输出由每条消息的代码决定 */
+            output_writer_t *writer = batch->partition ? NULL : input_file_writer(batch, file);
+            if (writer || batch->partition) {
+                output_stream_bind(&out, writer);
+                parse_segment(ctx, file->data + seg->start, file->data + seg->end,
+                              file->data + file->size, &out);
+                /* 分文件输出时, 关闭文件前暂存数据必须写入 */
+                output_stream_flush(&out);
+            } else {
+                ctx->errors_found++;
+            }
+            
+            input_file_segment_done(batch, file, ctx->messages_parsed - messages_before);
+        }
+    }
+    
+    output_stream_release(&out);
+    if (batch->partition) {
+        symbol_partitions_release(ctx);
+    }
+    
+    ctx->cpu = sched_getcpu();
+    ctx->elapsed = now_seconds() - start_time;
+    return NULL;
+}
+
+/* 按序列号排序, 同一序列号保持文件中的先后顺序 */
+static int compare_arb_entries(const void *a, const void *b) {
+    const arb_entry_t *x = a;
+    const arb_entry_t *y = b;
+    if (x->seq_num != y->seq_num) return x->seq_num < y->seq_num ? -1 : 1;
+    return (x->msg > y->msg) - (x->msg < y->msg);
+}
+
+/* 第一个序列号不小于seq的位置 */
+static size_t arb_lower_bound(const arb_entry_t *entries, size_t count, uint64_t seq) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].seq_num < seq) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* 阶段1: 记录数据段中每条消息的序列号, 时间戳和位置. 各类消息共用序列号, 都要参与缺口统计 */
+static int index_segment(thread_context_t *ctx, const uint8_t *start, const uint8_t *end,
+                         const uint8_t *limit, arb_index_t *index) {
+    const uint8_t *ptr = start;
+    const step_header_t *header;
+    
+    while ((header = next_step_message(&ptr, end, limit)) != NULL) {
+        if (index->count == index->cap) {
+            size_t cap = index->cap ? index->cap * 2 : 4096;
+            arb_entry_t *entries = realloc(index->entries, cap * sizeof(arb_entry_t));
+            if (!entries) return -1;
+            index->entries = entries;
+            index->cap = cap;
+        }
+        index->entries[index->count++] = (arb_entry_t){
+            ptr, header->timestamp, header->seq_num
+        };
+        
+        ctx->bytes_processed += header->msg_length;
+        ptr += header->msg_length;
+    }
+    return 0;
+}
+
+/* 按序列号排序(抓包通常已有序, 乱序时才排序), 重复的序列号只保留文件中第一次出现的 */
+static void arb_sort_unique(arb_index_t *index) {
+    int sorted = 1;
+    for (size_t i = 1; i < index->count && sorted; i++) {
+        sorted = index->entries[i - 1].seq_num <= index->entries[i].seq_num;
+    }
+    if (!sorted) {
+        qsort(index->entries, index->count, sizeof(arb_entry_t), compare_arb_entries);
+    }
+    
+    size_t n = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        if (n == 0 || index->entries[i].seq_num != index->entries[n - 1].seq_num) {
+            index->entries[n++] = index->entries[i];
+        }
+    }
+    index->count = n;
+}
+
+/*
+ * 阶段之间由一个线程执行, 只做与数据段数和区间数成正比的工作:
+ * 各数据段已排好序, 同一文件的数据段首尾相接时线路索引按段并行拷贝,
+ * 有交叠的线路整条交给一个线程排序去重; 然后按序列号切分仲裁区间.
+ */
+static int arbitration_plan(parse_batch_t *batch) {
+    arbitration_t *arb = batch->arb;
+    uint64_t min_seq = UINT64_MAX;
+    uint64_t max_seq = 0;
+    size_t total = 0;
+    
+    arb->tasks = malloc(batch->num_segments * sizeof(arb_task_t));
+    if (!arb->tasks) return -1;
+    
+    for (int f = 0; f < batch->num_files; f++) {
+        arb_index_t *line = &arb->lines[f];
+        int first_task = arb->num_tasks;
+        int overlap = 0;
+        int have_prev = 0;
+        uint64_t prev_last = 0;
+        size_t offset = 0;
+        
+        /* 同一文件的数据段按文件顺序排列 */
+        for (int s = 0; s < batch->num_segments; s++) {
+            arb_index_t *seg = &arb->segment_index[s];
+            if (batch->segments[s].file_idx != f || seg->count == 0) continue;
+            
+            uint64_t first = seg->entries[0].seq_num;
+            uint64_t last = seg->entries[seg->count - 1].seq_num;
+            if (have_prev && first < prev_last) overlap = 1;
+            
+            /* 跨数据段边界的重传: 只可能与上一段的最后一条重复 */
+            size_t skip = (have_prev && first == prev_last) ? 1 : 0;
+            arb->tasks[arb->num_tasks++] = (arb_task_t){ f, s, offset, skip };
+            offset += seg->count - skip;
+            line->cap += seg->count;
+            
+            if (first < min_seq) min_seq = first;
+            if (last > max_seq) max_seq = last;
+            prev_last = last;
+            have_prev = 1;
+        }
+        
+        line->entries = malloc((line->cap ? line->cap : 1) * sizeof(arb_entry_t));
+        if (!line->entries) return -1;
+        
+        if (overlap) {
+            arb->num_tasks = first_task;
+            arb->tasks[arb->num_tasks++] = (arb_task_t){ f, -1, 0, 0 };
+            total += line->cap;
+        } else {
+            line->count = offset;
+            total += offset;
+        }
+    }
+    
+    if (total == 0) {
+        arb->num_ranges = 0;
+        return 0;
+    }
+    
+    /* 区间数: 每个线程若干个, 且每个区间的消息数有上限 */
+    uint64_t span = max_seq - min_seq + 1;
+    uint64_t num_ranges = batch->config->num_threads * 4;
+    if (total / ARB_RANGE_MESSAGES > num_ranges) num_ranges = total / ARB_RANGE_MESSAGES;
+    if (num_ranges > span) num_ranges = span;
+    
+    arb->ranges = calloc(num_ranges, sizeof(arb_range_t));
+    if (!arb->ranges) return -1;
+    for (uint64_t r = 0; r < num_ranges; r++) {
+        arb->ranges[r].lo = min_seq + span * r / num_ranges;
+        arb->ranges[r].hi = min_seq + span * (r + 1) / num_ranges;
+    }
+    arb->num_ranges = num_ranges;
+    arb->min_seq = min_seq;
+    arb->max_seq = max_seq;
+    return 0;
+}
+
+static void arb_copy_segment(arb_index_t *line, arb_index_t *seg, size_t offset, size_t skip) {
+    memcpy(line->entries + offset, seg->entries + skip, (seg->count - skip) * sizeof(arb_entry_t));
+    free(seg->entries);
+    seg->entries = NULL;
+}
+
+/* 执行一个建线路索引的任务 */
+static void arb_run_task(parse_batch_t *batch, const arb_task_t *task) {
+    arbitration_t *arb = batch->arb;
+    arb_index_t *line = &arb->lines[task->line];
+    
+    if (task->segment >= 0) {
+        arb_copy_segment(line, &arb->segment_index[task->segment], task->offset, task->skip);
+        return;
+    }
+    
+    /* 数据段之间有乱序: 拼接后整条线路排序去重 */
+    for (int s = 0; s < batch->num_segments; s++) {
+        arb_index_t *seg = &arb->segment_index[s];
+        if (batch->segments[s].file_idx != task->line || !seg->entries) continue;
+        size_t count = seg->count;
+        arb_copy_segment(line, seg, line->count, 0);
+        line->count += count;
+    }
+    arb_sort_unique(line);
+}
+
+/* 记录缺口: 与前一段连续且缺失线路和补缺线路相同时合并 */
+static int arb_add_gap(arb_range_t *range, uint64_t first, uint64_t last,
+                       uint64_t missing, int supplier) {
+    if (range->num_gaps > 0) {
+        arb_gap_t *prev = &range->gaps[range->num_gaps - 1];
+        if (prev->last + 1 == first && prev->missing == missing && prev->supplier == supplier) {
+            prev->last = last;
+            return 0;
+        }
+    }
+    if (range->num_gaps == range->gaps_cap) {
+        size_t cap = range->gaps_cap ? range->gaps_cap * 2 : 64;
+        arb_gap_t *gaps = realloc(range->gaps, cap * sizeof(arb_gap_t));
+        if (!gaps) return -1;
+        range->gaps = gaps;
+        range->gaps_cap = cap;
+    }
+    range->gaps[range->num_gaps++] = (arb_gap_t){first, last, missing, supplier};
+    return 0;
+}
+
+/*
+ * 阶段2: 仲裁一个序列号区间. 每个序列号取时间戳最早的副本(相同时取编号小的线路),
+ * 结果按序列号顺序格式化到内存, 轮到本区间时追加到输出文件.
+ */
+static void arbitrate_range(thread_context_t *ctx, parse_batch_t *batch, int r) {
+    arbitration_t *arb = batch->arb;
+    arb_range_t *range = &arb->ranges[r];
+    int num_lines = batch->num_files;
+    uint64_t all_lines = num_lines == 64 ? ~0ULL : (1ULL << num_lines) - 1;
+    size_t pos[ARB_MAX_LINES];
+    size_t end[ARB_MAX_LINES];
+    char *buf = NULL;
+    size_t used = 0;
+    size_t cap = 0;
+    int failed = 0;
+    
+    for (int l = 0; l < num_lines; l++) {
+        arb_index_t *line = &arb->lines[l];
+        pos[l] = arb_lower_bound(line->entries, line->count, range->lo);
+        end[l] = arb_lower_bound(line->entries, line->count, range->hi);
+    }
+    
+    uint64_t expected = range->lo;
+    for (;;) {
+        /* 各线路当前最小的序列号 */
+        uint64_t seq = UINT64_MAX;
+        for (int l = 0; l < num_lines; l++) {
+            if (pos[l] < end[l] && arb->lines[l].entries[pos[l]].seq_num < seq) {
+                seq = arb->lines[l].entries[pos[l]].seq_num;
+            }
+        }
+        if (seq == UINT64_MAX) break;
+        
+        if (seq > expected && arb_add_gap(range, expected, seq - 1, all_lines, -1) < 0) {
+            failed = 1;
+        }
+        
+        /* 该序列号在各线路上的副本 */
+        const arb_entry_t *copy[ARB_MAX_LINES];
+        uint64_t present = 0;
+        for (int l = 0; l < num_lines; l++) {
+            if (pos[l] >= end[l]) continue;
+            const arb_entry_t *e = &arb->lines[l].entries[pos[l]];
+            if (e->seq_num != seq) continue;
+            copy[l] = e;
+            present |= 1ULL << l;
+            pos[l]++;
+        }
+        
+        if (used + MAX_CSV_LINE_LEN > cap) {
+            size_t new_cap = cap ? cap * 2 : 1024 * 1024;
+            char *p = realloc(buf, new_cap);
+            if (!p) {
+                failed = 1;
+                break;
+            }
+            buf = p;
+            cap = new_cap;
+        }
+        
+        /*
+         * 按时间戳从早到晚(相同时线路编号小的优先)选用副本, 解析失败的副本视同缺失,
+         * 改用下一个. 非行情消息只占用序列号, 不输出.
+         */
+        uint64_t usable = present;
+        int winner_line = -1;
+        while (usable) {
+            int best = -1;
+            for (int l = 0; l < num_lines; l++) {
+                if ((usable & (1ULL << l)) &&
+                    (best < 0 || copy[l]->timestamp < copy[best]->timestamp)) {
+                    best = l;
+                }
+            }
+            
+            const step_header_t *header = (const step_header_t *)copy[best]->msg;
+            if (header->msg_type != STEP_MARKET_DATA) {
+                winner_line = best;
+                break;
+            }
+            int csv_len = -1;
+            if (header->msg_length > sizeof(step_header_t) + sizeof(step_trailer_t)) {
+                csv_len = parse_fast_message(copy[best]->msg + sizeof(step_header_t),
+                                             header->msg_length - sizeof(step_header_t) - sizeof(step_trailer_t),
+                                             buf + used, MAX_CSV_LINE_LEN - 1);
+            }
+            if (csv_len >= 0) {
+                buf[used + csv_len] = '\n';
+                used += csv_len + 1;
+                ctx->messages_parsed++;
+                winner_line = best;
+                break;
+            }
+            ctx->errors_found++;
+            usable &= ~(1ULL << best);
+        }
+        if (winner_line >= 0) range->selected[winner_line]++;
+        
+        if (usable != all_lines &&
+            arb_add_gap(range, seq, seq, all_lines & ~usable, winner_line) < 0) {
+            failed = 1;
+        }
+        
+        expected = seq + 1;
+    }
+    
+    if (!failed && expected < range->hi &&
+        arb_add_gap(range, expected, range->hi - 1, all_lines, -1) < 0) {
+        failed = 1;
+    }
+    if (failed) {
+        fprintf(stderr, "Thread %d: out of memory arbitrating seq %lu-%lu\n",
+                ctx->thread_idx, range->lo, range->hi - 1);
+        batch->io_error = 1;
+    }
+    
+    /* 按区间顺序追加到输出文件 */
+    pthread_mutex_lock(&arb->commit_mutex);
+    while (arb->next_commit != r) {
+        pthread_cond_wait(&arb->commit_cond, &arb->commit_mutex);
+    }
+    pthread_mutex_unlock(&arb->commit_mutex);
+    
+    if (used > 0) {
+        output_writer_write(&batch->merged_writer, buf, used, ctx->node);
+    }
+    
+    pthread_mutex_lock(&arb->commit_mutex);
+    arb->next_commit++;
+    pthread_cond_broadcast(&arb->commit_cond);
+    pthread_mutex_unlock(&arb->commit_mutex);
+    
+    free(buf);
+}
+
+/* 仲裁模式的线程工作函数: 阶段1并行建索引, 再按数据段并行拼接各线路的索引, 阶段2按序列号区间并行仲裁 */
+static void *arbitrate_thread_func(void *arg) {
+    thread_context_t *ctx = (thread_context_t *)arg;
+    parse_batch_t *batch = ctx->batch;
+    arbitration_t *arb = batch->arb;
+    
+    /* 仲裁的两个阶段之间有屏障, 必须所有线程都已启动 */
+    if (!batch_wait_start(batch)) return NULL;
+    double start_time = now_seconds();
+    
+    for (;;) {
+        int job_idx = __atomic_fetch_add(&batch->next_job, 1, __ATOMIC_RELAXED);
+        if (job_idx >= batch->num_jobs) break;
+        
+        parse_job_t *job = &batch->jobs[job_idx];
+        for (int i = 0; i < job->num_segments; i++) {
+            int seg_idx = job->first_segment + i;
+            job_segment_t *seg = &batch->segments[seg_idx];
+            input_file_t *file = &batch->files[seg->file_idx];
+            
+            arb_index_t *index = &arb->segment_index[seg_idx];
+            if (index_segment(ctx, file->data + seg->start, file->data + seg->end,
+                              file->data + file->size, index) < 0) {
+                fprintf(stderr, "Thread %d: out of memory indexing %s\n",
+                        ctx->thread_idx, file->path);
+                batch->io_error = 1;
+            }
+            arb_sort_unique(index);
+        }
+    }
+    
+    if (pthread_barrier_wait(&arb->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        if (!batch->io_error && arbitration_plan(batch) < 0) {
+            fprintf(stderr, "Out of memory building arbitration index\n");
+            batch->io_error = 1;
+        }
+        if (batch->io_error) {
+            arb->num_tasks = 0;
+            arb->num_ranges = 0;
+        }
+    }
+    pthread_barrier_wait(&arb->barrier);
+    
+    /* 并行建立各线路的索引 */
+    for (;;) {
+        int t = __atomic_fetch_add(&arb->next_task, 1, __ATOMIC_RELAXED);
+        if (t >= arb->num_tasks) break;
+        arb_run_task(batch, &arb->tasks[t]);
+    }
+    pthread_barrier_wait(&arb->barrier);
+    
+    for (;;) {
+        int r = __atomic_fetch_add(&arb->next_range, 1, __ATOMIC_RELAXED);
+        if (r >= arb->num_ranges) break;
+        arbitrate_range(ctx, batch, r);
+    }
+    
+    ctx->cpu = sched_getcpu();
+    ctx->elapsed = now_seconds() - start_time;
+    return NULL;
+}
+
+static void print_line_mask(FILE *fp, uint64_t mask) {
+    const char *sep = "";
+    for (int l = 0; l < ARB_MAX_LINES; l++) {
+        if (mask & (1ULL << l)) {
+            fprintf(fp, "%s%d", sep, l);
+            sep = ";";
+        }
+    }
+}
+
+/* 合并各区间的缺口记录, 写出缺口报告并打印各线路的统计 */
+static int arbitration_report(parse_batch_t *batch) {
+    arbitration_t *arb = batch->arb;
+    int num_lines = batch->num_files;
+    size_t selected[ARB_MAX_LINES] = {0};
+    size_t missing[ARB_MAX_LINES] = {0};
+    size_t filled = 0;
+    size_t unrecoverable = 0;
+    size_t runs = 0;
+    
+    char path[512];
+    snprintf(path, sizeof(path), "%s_gaps.csv", batch->config->output_prefix);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(fp, "StartSeq,EndSeq,Count,MissingLines,SuppliedBy\n");
+    
+    /* 区间边界处的连续缺口合并为一条 */
+    arb_gap_t run = {0, 0, 0, -2};
+    for (int r = 0; r <= arb->num_ranges; r++) {
+        arb_range_t *range = r < arb->num_ranges ? &arb->ranges[r] : NULL;
+        size_t n = range ? range->num_gaps : 1;
+        
+        for (size_t g = 0; g < n; g++) {
+            arb_gap_t *gap = range ? &range->gaps[g] : NULL;
+            if (gap && run.supplier != -2 && run.last + 1 == gap->first &&
+                run.missing == gap->missing && run.supplier == gap->supplier) {
+                run.last = gap->last;
+                continue;
+            }
+            
+            if (run.supplier != -2) {
+                uint64_t count = run.last - run.first + 1;
+                fprintf(fp, "%lu,%lu,%lu,", run.first, run.last, count);
+                print_line_mask(fp, run.missing);
+                if (run.supplier >= 0) fprintf(fp, ",%d\n", run.supplier);
+                else fprintf(fp, ",none\n");
+                
+                for (int l = 0; l < num_lines; l++) {
+                    if (run.missing & (1ULL << l)) missing[l] += count;
+                }
+                if (run.supplier >= 0) filled += count;
+                else unrecoverable += count;
+                runs++;
+            }
+            if (gap) run = *gap;
+        }
+        
+        if (range) {
+            for (int l = 0; l < num_lines; l++) selected[l] += range->selected[l];
+        }
+    }
+    fclose(fp);
+    
+    printf("\nArbitration: %d lines", num_lines);
+    if (arb->num_ranges > 0) {
+        printf(", seq %lu-%lu, %d ranges", arb->min_seq, arb->max_seq, arb->num_ranges);
+    }
+    printf("\n");
+    for (int l = 0; l < num_lines; l++) {
+        printf("  Line %d (%s): %zu messages, %zu selected, %zu missing\n",
+               l, batch->files[l].path, arb->lines[l].count, selected[l], missing[l]);
+    }
+    printf("  Gaps: %zu runs, %zu filled from another line, %zu unrecoverable -> %s\n",
+           runs, filled, unrecoverable, path);
+    return 0;
+}
+
+static int arbitration_init(parse_batch_t *batch) {
+    arbitration_t *arb = calloc(1, sizeof(arbitration_t));
+    if (!arb) return -1;
+    
+    arb->segment_index = calloc(batch->num_segments, sizeof(arb_index_t));
+    arb->lines = calloc(batch->num_files, sizeof(arb_index_t));
+    if (!arb->segment_index || !arb->lines) {
+        free(arb->segment_index);
+        free(arb->lines);
+        free(arb);
+        return -1;
+    }
+    
+    pthread_barrier_init(&arb->barrier, NULL, batch->config->num_threads);
+    pthread_mutex_init(&arb->commit_mutex, NULL);
+    pthread_cond_init(&arb->commit_cond, NULL);
+    batch->arb = arb;
+    return 0;
+}
+
+static void arbitration_destroy(parse_batch_t *batch) {
+    arbitration_t *arb = batch->arb;
+    if (!arb) return;
+    
+    for (int s = 0; s < batch->num_segments; s++) {
+        free(arb->segment_index[s].entries);
+    }
+    free(arb->segment_index);
+    for (int f = 0; f < batch->num_files; f++) {
+        free(arb->lines[f].entries);
+    }
+    free(arb->lines);
+    for (int r = 0; r < arb->num_ranges; r++) {
+        free(arb->ranges[r].gaps);
+    }
+    free(arb->ranges);
+    free(arb->tasks);
+    pthread_barrier_destroy(&arb->barrier);
+    pthread_mutex_destroy(&arb->commit_mutex);
+    pthread_cond_destroy(&arb->commit_cond);
+    free(arb);
+    batch->arb = NULL;
+}
+
+/* 按名称排序 */
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int add_input_path(char ***paths, int *count, int *cap, const char *path) {
+    if (*count == *cap) {
+        int new_cap = *cap ? *cap * 2 : 16;
+        char **p = realloc(*paths, new_cap * sizeof(char *));
+        if (!p) return -1;
+        *paths = p;
+        *cap = new_cap;
+    }
+    (*paths)[*count] = strdup(path);
+    if (!(*paths)[*count]) return -1;
+    (*count)++;
+    return 0;
+}
+
+/* 展开输入: 普通文件, 目录(其中的全部普通文件), 通配符, 或 @列表文件(每行一个路径) */
+static int collect_input_paths(const char *spec, char ***paths, int *count) {
+    int cap = 0;
+    struct stat st;
+    *paths = NULL;
+    *count = 0;
+    
+    if (spec[0] == '@') {
+        FILE *fp = fopen(spec + 1, "r");
+        if (!fp) {
+            fprintf(stderr, "Failed to open input list %s: %s\n", spec + 1, strerror(errno));
+            return -1;
+        }
+        char line[4096];
+        while (fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0' || line[0] == '#') continue;
+            if (add_input_path(paths, count, &cap, line) < 0) {
+                fclose(fp);
+                return -1;
+            }
+        }
+        fclose(fp);
+    } else if (stat(spec, &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(spec);
+        if (!dir) {
+            fprintf(stderr, "Failed to open directory %s: %s\n", spec, strerror(errno));
+            return -1;
+        }
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            char path[4096];
+            if (ent->d_name[0] == '.') continue;
+            snprintf(path, sizeof(path), "%s/%s", spec, ent->d_name);
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (add_input_path(paths, count, &cap, path) < 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        qsort(*paths, *count, sizeof(char *), compare_paths);
+    } else if (strpbrk(spec, "*?[")) {
+        glob_t g;
+        if (glob(spec, 0, NULL, &g) == 0) {
+            for (size_t i = 0; i < g.gl_pathc; i++) {
+                if (add_input_path(paths, count, &cap, g.gl_pathv[i]) < 0) {
+                    globfree(&g);
+                    return -1;
+                }
+            }
+        }
+        globfree(&g);
+    } else {
+        if (add_input_path(paths, count, &cap, spec) < 0) return -1;
+    }
+    
+    if (*count == 0) {
+        fprintf(stderr, "No input files match %s\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+/* 分文件输出的文件名: <前缀>_<输入文件名去掉扩展名>_market_data.csv */
+static void make_output_path(char *buf, size_t size, const char *prefix, const char *input) {
+    const char *name = strrchr(input, '/');
+    name = name ? name + 1 : input;
+    const char *ext = strrchr(name, '.');
+    int stem_len = (ext && ext != name) ? (int)(ext - name) : (int)strlen(name);
+    snprintf(buf, size, "%s_%.*s_market_data.csv", prefix, stem_len, name);
+}
+
+static int compare_output_paths(const void *a, const void *b) {
+    const input_file_t *x = *(input_file_t * const *)a;
+    const input_file_t *y = *(input_file_t * const *)b;
+    int c = strcmp(x->output_path, y->output_path);
+    return c ? c : (x < y ? -1 : x > y);
+}
+
+/* 在"_market_data.csv"之前插入输入在批次中的序号 */
+static void add_output_index(parse_batch_t *batch, input_file_t *file) {
+    const char *suffix = "_market_data.csv";
+    size_t base = strlen(file->output_path);
+    if (base >= strlen(suffix) && strcmp(file->output_path + base - strlen(suffix), suffix) == 0) {
+        base -= strlen(suffix);
+    }
+    
+    char renamed[sizeof(file->output_path)];
+    snprintf(renamed, sizeof(renamed), "%.*s_%d%s", (int)base, file->output_path,
+             (int)(file - batch->files), suffix);
+    fprintf(stderr, "Output name of %s is shared with another input, writing %s\n",
+            file->path, renamed);
+    memcpy(file->output_path, renamed, sizeof(renamed));
+}
+
+/* 按输出文件名排序, 找出同名的输入; rename非0时给同名的输入都加上序号, 否则报告冲突 */
+static int find_output_collisions(parse_batch_t *batch, input_file_t **sorted, int rename) {
+    int collisions = 0;
+    
+    for (int f = 0; f < batch->num_files; f++) sorted[f] = &batch->files[f];
+    qsort(sorted, batch->num_files, sizeof(input_file_t *), compare_output_paths);
+    
+    for (int f = 0; f < batch->num_files; ) {
+        int g = f + 1;
+        while (g < batch->num_files && strcmp(sorted[g]->output_path, sorted[f]->output_path) == 0) {
+            g++;
+        }
+        if (g - f > 1) {
+            collisions++;
+            if (!rename) {
+                fprintf(stderr, "Output name collision: %s and %s both map to %s\n",
+                        sorted[f]->path, sorted[f + 1]->path, sorted[f]->output_path);
+            }
+            for (int k = f; k < g && rename; k++) {
+                add_output_index(batch, sorted[k]);
+            }
+        }
+        f = g;
+    }
+    return collisions;
+}
+
+/*
+ * 分文件输出时不同目录下的同名文件, 或只有扩展名不同的文件会映射到同一个CSV,
+ * 加序号区分; 加序号后仍然冲突(如与另一输入的文件名巧合)则拒绝运行.
+ */
+static int make_output_paths_unique(parse_batch_t *batch) {
+    input_file_t **sorted = malloc(batch->num_files * sizeof(input_file_t *));
+    if (!sorted) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    
+    int ret = 0;
+    if (find_output_collisions(batch, sorted, 1) > 0 &&
+        find_output_collisions(batch, sorted, 0) > 0) {
+        ret = -1;
+    }
+    free(sorted);
+    return ret;
+}
+
+/* 切分任务: 大文件按块大小切成多段, 小文件合并成一个任务 */
+static int build_jobs(parse_batch_t *batch, size_t total_bytes) {
+    parser_config_t *config = batch->config;
+    
+    /* 任务大小不超过chunk_size, 且保证每个线程都有任务可做 */
+    size_t target = total_bytes / config->num_threads;
+    if (target > config->chunk_size) target = config->chunk_size;
+    if (target < MIN_JOB_SIZE) target = MIN_JOB_SIZE;
+    
+    size_t max_segments = batch->num_files;
+    for (int f = 0; f < batch->num_files; f++) {
+        max_segments += batch->files[f].size / target + 1;
+    }
+    batch->segments = calloc(max_segments, sizeof(job_segment_t));
+    batch->jobs = calloc(max_segments, sizeof(parse_job_t));
+    if (!batch->segments || !batch->jobs) return -1;
+    
+    int nseg = 0;
+    int njob = 0;
+    size_t group_bytes = 0;     /* 当前小文件组的累计大小 */
+    
+    for (int f = 0; f < batch->num_files; f++) {
+        input_file_t *file = &batch->files[f];
+        if (file->size == 0) continue;
+        
+        if (file->size >= target) {
+            size_t pieces = (file->size + target - 1) / target;
+            for (size_t k = 0; k < pieces; k++) {
+                batch->segments[nseg] = (job_segment_t){
+                    f, file->size * k / pieces, file->size * (k + 1) / pieces
+                };
+                batch->jobs[njob++] = (parse_job_t){nseg++, 1};
+            }
+            file->pending_segments = pieces;
+        } else {
+            if (group_bytes == 0) {
+                batch->jobs[njob++] = (parse_job_t){nseg, 0};
+            }
+            batch->segments[nseg++] = (job_segment_t){f, 0, file->size};
+            batch->jobs[njob - 1].num_segments++;
+            file->pending_segments = 1;
+            
+            group_bytes += file->size;
+            if (group_bytes >= target) group_bytes = 0;
+        }
+    }
+    
+    batch->num_jobs = njob;
+    batch->num_segments = nseg;
+    return 0;
+}
+
+/* 映射全部输入文件, 在共享线程池上解析 */
+int parse_step_file(parser_config_t *config) {
+    parse_batch_t batch;
+    char **paths;
+    int num_paths;
+    
+    memset(&batch, 0, sizeof(batch));
+    batch.config = config;
+    
+    if (collect_input_paths(config->input_file, &paths, &num_paths) < 0) {
+        return -1;
+    }
+    
+    /* 单个输入或-M时合并输出到<前缀>_market_data.csv */
+    batch.merged = (num_paths == 1) || config->merge_output;
+    
+    /* 按代码分区时所有输入的同一代码写入同一个文件 */
+    batch.partition = config->partition_by_symbol;
+    if (batch.partition) batch.merged = 0;
+    
+    /* 仲裁模式: 各输入是同一行情的冗余线路, 合并为一个按序列号排列的输出 */
+    if (config->arbitrate) {
+        batch.partition = 0;
+        batch.merged = 1;
+    }
+    
+    double start_time = now_seconds();
+    batch.files = calloc(num_paths, sizeof(input_file_t));
+    size_t total_bytes = 0;
+    
+    /* 内存映射 */
+    for (int i = 0; i < num_paths; i++) {
+        input_file_t *file = &batch.files[batch.num_files];
+        
+        int fd = open(paths[i], O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open file %s: %s\n", paths[i], strerror(errno));
+            batch.io_error = 1;
+            continue;
+        }
+        
+        /* 获取文件大小 */
+        struct stat st;
+        fstat(fd, &st);
+        if (st.st_size == 0) {
+            fprintf(stderr, "Skipping empty file %s\n", paths[i]);
+            close(fd);
+            continue;
+        }
+        
+        file->size = st.st_size;
+        file->data = map_input_file(fd, file->size, config);
+        close(fd);
+        if (file->data == NULL) {
+            fprintf(stderr, "mmap %s failed: %s\n", paths[i], strerror(errno));
+            batch.io_error = 1;
+            continue;
+        }
+        
+        file->path = paths[i];
+        make_output_path(file->output_path, sizeof(file->output_path),
+                         config->output_prefix, paths[i]);
+        pthread_mutex_init(&file->mutex, NULL);
+        total_bytes += file->size;
+        batch.num_files++;
+    }
+    
+    int ret = -1;
+    if (batch.num_files == 0) {
+        fprintf(stderr, "No input data\n");
+        goto cleanup_paths;
+    }
+    if (config->arbitrate && (batch.num_files < 2 || batch.num_files > ARB_MAX_LINES)) {
+        fprintf(stderr, "Arbitration needs 2 to %d input files, got %d\n",
+                ARB_MAX_LINES, batch.num_files);
+        goto cleanup_files;
+    }
+    if (!batch.merged && !batch.partition && make_output_paths_unique(&batch) < 0) {
+        goto cleanup_files;
+    }
+    
+    /* 创建CSV文件 */
+    output_io_init(&batch.io, config->io_backend, config->output_block_size);
+    if (batch.partition) {
+        pthread_mutex_init(&batch.symbol_mutex, NULL);
+        batch.symbol_writers = calloc(SYMBOL_MAX_COUNT, sizeof(output_writer_t *));
+        batch.symbol_messages = calloc(SYMBOL_MAX_COUNT, sizeof(size_t));
+        if (symbol_table_init(&batch.symbols) < 0 ||
+            !batch.symbol_writers || !batch.symbol_messages) {
+            fprintf(stderr, "Out of memory\n");
+            goto cleanup_io;
+        }
+        
+        /* 每个代码一个输出文件, 放宽文件描述符上限 */
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+    if (batch.merged) {
+        char csv_filename[512];
+        snprintf(csv_filename, sizeof(csv_filename), "%s_market_data.csv", 
+                 config->output_prefix);
+        
+        if (output_writer_open(&batch.merged_writer, &batch.io, csv_filename,
+                               MARKET_DATA_CSV_HEADER, config->direct_io) < 0) {
+            goto cleanup_io;
+        }
+    }
+    
+    if (build_jobs(&batch, total_bytes) < 0 ||
+        (config->arbitrate && arbitration_init(&batch) < 0)) {
+        fprintf(stderr, "Out of memory\n");
+        if (batch.merged) output_writer_close(&batch.merged_writer);
+        goto cleanup_io;
+    }
+    
+    if (num_paths > 1) {
+        printf("Batch: %d files, %zu bytes, %d jobs, %s output\n", batch.num_files,
+               total_bytes, batch.num_jobs,
+               batch.arb ? "arbitrated" : batch.merged ? "merged" : "per-file");
+    }
+    
+    thread_context_t *threads = calloc(config->num_threads, sizeof(thread_context_t));
+    
+    cpu_topology_t topo;
+    topology_load(&topo);
+    
+    void *(*thread_func)(void *) = batch.arb ? arbitrate_thread_func : parse_thread_func;
+    
+    pthread_mutex_init(&batch.start_mutex, NULL);
+    pthread_cond_init(&batch.start_cond, NULL);
+    
+    /* 创建线程 */
+    int started = 0;
+    for (int i = 0; i < config->num_threads; i++) {
+        threads[i].thread_idx = i;
+        threads[i].config = config;
+        threads[i].batch = &batch;
+        threads[i].node = -1;
+        
+        /* 创建线程, 按配置绑定到CPU或NUMA节点 */
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (config->affinity != AFFINITY_NONE) {
+            cpu_set_t cpus;
+            threads[i].node = topology_place(&topo, config->affinity, i, &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        int rc = pthread_create(&threads[i].thread_id, &attr, thread_func, &threads[i]);
+        if (rc != 0 && config->affinity != AFFINITY_NONE) {
+            fprintf(stderr, "Thread %d: affinity rejected, starting unbound\n", i);
+            threads[i].node = -1;
+            rc = pthread_create(&threads[i].thread_id, NULL, thread_func, &threads[i]);
+        }
+        pthread_attr_destroy(&attr);
+        if (rc != 0) {
+            fprintf(stderr, "Failed to create thread %d: %s\n", i, strerror(rc));
+            break;
+        }
+        started++;
+    }
+    
+    batch_start(&batch, started == config->num_threads ? 1 : -1);
+    if (started < config->num_threads) {
+        /* 已启动的解析线程不再领取新任务 */
+        __atomic_store_n(&batch.next_job, batch.num_jobs, __ATOMIC_RELAXED);
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i].thread_id, NULL);
+        }
+        batch.io_error = 1;
+        goto cleanup_threads;
+    }
+    
+    /* 等待线程完成 */
+    size_t total_processed = 0;
+    size_t total_messages = 0;
+    
+    for (int i = 0; i < config->num_threads; i++) {
+        pthread_join(threads[i].thread_id, NULL);
+        
+        total_processed += threads[i].bytes_processed;
+        total_messages += threads[i].messages_parsed;
+        
+        if (config->verbose) {
+            printf("Thread %d: processed %ld bytes, %ld messages, %ld errors\n",
+                   i, threads[i].bytes_processed, 
+                   threads[i].messages_parsed, threads[i].errors_found);
+        }
+    }
+    
+    /* 线程放置与吞吐报告 */
+    if (config->verbose) {
+        printf("\nPlacement:\n");
+        for (int i = 0; i < config->num_threads; i++) {
+            double mb = threads[i].bytes_processed / (1024.0 * 1024.0);
+            int cpu = threads[i].cpu;
+            printf("  Thread %d: cpu %d, node %d%s, %.3f s, %.1f MB/s\n",
+                   i, cpu, cpu >= 0 ? topo.cpu_node[cpu] : -1,
+                   threads[i].node >= 0 ? " (bound)" : "",
+                   threads[i].elapsed,
+                   threads[i].elapsed > 0 ? mb / threads[i].elapsed : 0.0);
+        }
+    }
+    
+    if (config->verbose && !batch.merged && !batch.partition) {
+        printf("\nFiles:\n");
+        for (int f = 0; f < batch.num_files; f++) {
+            printf("  %s: %zu messages -> %s\n", batch.files[f].path,
+                   batch.files[f].messages, batch.files[f].output_path);
+        }
+    }
+    
+    if (batch.arb && arbitration_report(&batch) < 0) {
+        batch.io_error = 1;
+    }
+    
+    double elapsed = now_seconds() - start_time;
+    printf("\nTotal: %ld bytes, %ld messages parsed\n", total_processed, total_messages);
+    printf("Elapsed: %.3f s, %.1f MB/s\n", elapsed,
+           elapsed > 0 ? total_bytes / (1024.0 * 1024.0) / elapsed : 0.0);
+    
+    /* 清理资源 */
+cleanup_threads:
+    ret = batch.io_error ? -1 : 0;
+    if (batch.merged && output_writer_close(&batch.merged_writer) < 0) {
+        ret = -1;
+    }
+    if (batch.partition && symbol_outputs_close(&batch) < 0) {
+        ret = -1;
+    }
+    free(threads);
+    pthread_mutex_destroy(&batch.start_mutex);
+    pthread_cond_destroy(&batch.start_cond);
+    
+cleanup_io:
+    output_io_destroy(&batch.io);
+    if (batch.partition) {
+        symbol_table_destroy(&batch.symbols);
+        free(batch.symbol_writers);
+        free(batch.symbol_messages);
+        pthread_mutex_destroy(&batch.symbol_mutex);
+    }
+    free(batch.jobs);
+    free(batch.segments);
+    arbitration_destroy(&batch);
+cleanup_files:
+    for (int f = 0; f < batch.num_files; f++) {
+        munmap((void *)batch.files[f].data, batch.files[f].size);
+        pthread_mutex_destroy(&batch.files[f].mutex);
+    }
+cleanup_paths:
+    free(batch.files);
+    for (int i = 0; i < num_paths; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    
+    return ret;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <input> <output_prefix> [num_threads]\n", prog);
+    fprintf(stderr, "  <input> is a file, a directory, a quoted glob, or @list (one path per line)\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -b <uring|pwrite>  output backend (default: uring, pwrite if unavailable)\n");
+    fprintf(stderr, "  -D                 write output with O_DIRECT\n");
+    fprintf(stderr, "  -B <KB>            output block size in KB (default: %d)\n",
+            OUTPUT_BLOCK_SIZE / 1024);
+    fprintf(stderr, "  -a <none|core|node> pin worker threads to cores or NUMA nodes\n");
+    fprintf(stderr, "  -P                 populate the input mapping up front (MAP_POPULATE)\n");
+    fprintf(stderr, "  -H                 map the input with transparent huge pages\n");
+    fprintf(stderr, "  -M                 merge batch output into one file (default: one per input)\n");
+    fprintf(stderr, "  -c <MB>            maximum job size in MB (default: 64)\n");
+    fprintf(stderr, "  -S                 write one CSV per symbol plus a symbol dictionary\n");
+    fprintf(stderr, "  -A                 arbitrate redundant feed captures (2+ inputs) by seq_num\n");
+}
+
+/* 主函数 */
+int main(int argc, char *argv[]) {
+    parser_config_t config = {
+        .num_threads = 4,  /* 默认4线程 */
+        .chunk_size = 64 * 1024 * 1024,  /* 64MB块 */
+        .verbose = 1,
+        .io_backend = OUTPUT_BACKEND_URING,
+        .direct_io = 0,
+        .output_block_size = OUTPUT_BLOCK_SIZE,
+        .affinity = AFFINITY_NONE
+    };
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "b:DB:a:PHMc:SA")) != -1) {
+        switch (opt) {
+            case 'b':
+                if (strcmp(optarg, "uring") == 0) {
+                    config.io_backend = OUTPUT_BACKEND_URING;
+                } else if (strcmp(optarg, "pwrite") == 0) {
+                    config.io_backend = OUTPUT_BACKEND_PWRITE;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'D':
+                config.direct_io = 1;
+                break;
+            case 'B': {
+                long kb = atol(optarg);
+                if (kb <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                config.output_block_size = (size_t)kb * 1024;
+                break;
+            }
+            case 'a':
+                if (strcmp(optarg, "none") == 0) {
+                    config.affinity = AFFINITY_NONE;
+                } else if (strcmp(optarg, "core") == 0) {
+                    config.affinity = AFFINITY_CORE;
+                } else if (strcmp(optarg, "node") == 0) {
+                    config.affinity = AFFINITY_NODE;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'P':
+                config.map_populate = 1;
+                break;
+            case 'H':
+                config.map_hugepage = 1;
+                break;
+            case 'M':
+                config.merge_output = 1;
+                break;
+            case 'S':
+                config.partition_by_symbol = 1;
+                break;
+            case 'A':
+                config.arbitrate = 1;
+                break;
+            case 'c': {
+                long mb = atol(optarg);
+                if (mb <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                config.chunk_size = (size_t)mb * 1024 * 1024;
+                break;
+            }
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    
+    if (argc - optind < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    /* 未加引号的通配符会被shell展开成多个参数, 后面的文件会被误当作输出前缀和线程数 */
+    if (argc - optind > 3) {
+        fprintf(stderr, "Too many arguments (%d); quote glob patterns or use @list\n",
+                argc - optind);
+        usage(argv[0]);
+        return 1;
+    }
+    
+    strncpy(config.input_file, argv[optind], sizeof(config.input_file) - 1);
+    strncpy(config.output_prefix, argv[optind + 1], sizeof(config.output_prefix) - 1);
+    
+    if (argc - optind >= 3) {
+        char *end;
+        long n = strtol(argv[optind + 2], &end, 10);
+        if (end == argv[optind + 2] || *end != '\0') {
+            fprintf(stderr, "Invalid thread count '%s'; quote glob patterns or use @list\n",
+                    argv[optind + 2]);
+            usage(argv[0]);
+            return 1;
+        }
+        config.num_threads = n > 0 ? (int)n : 4;
+    }
+    
+    /* O_DIRECT要求块大小按扇区对齐 */
+    config.output_block_size = (config.output_block_size + OUTPUT_ALIGN - 1) & ~(size_t)(OUTPUT_ALIGN - 1);
+    
+    if (config.io_backend == OUTPUT_BACKEND_URING && !uring_available()) {
+        fprintf(stderr, "io_uring not available, falling back to pwrite\n");
+        config.io_backend = OUTPUT_BACKEND_PWRITE;
+    }
+    
+    printf("Starting STEP/FAST parser:\n");
+    printf("  Input: %s\n", config.input_file);
+    printf("  Output prefix: %s\n", config.output_prefix);
+    printf("  Threads: %d\n", config.num_threads);
+    printf("  Output: %s%s, %zu KB blocks\n",
+           config.io_backend == OUTPUT_BACKEND_URING ? "io_uring" : "pwrite",
+           config.direct_io ? " + O_DIRECT" : "", config.output_block_size / 1024);
+    printf("  Affinity: %s\n", config.affinity == AFFINITY_CORE ? "core" :
+                                 config.affinity == AFFINITY_NODE ? "node" : "none");
+    printf("  Input mapping:%s%s\n", config.map_populate ? " populate" : "",
+           config.map_hugepage ? " hugepage" : (config.map_populate ? "" : " default"));
+    
+    return parse_step_file(&config);
+}
@@ -56,8 +56,111 @@ if [ -f "output_1thread_market_data.csv" ] && [ -f "output_8thread_market_data.c
     fi
 fi
 
-# 5. 性能测试
-echo -e "\n5. Performance test with large file..."
+# 5. 输出后端和块大小: 结果排序后应与默认运行一致, -B 4使槽位环反复轮转
+echo -e "\n5. Testing output options..."
+for opts in "-b pwrite" "-D" "-B 4" "-D -B 4"; do
+    ./step_fast_parser $opts test_data.bin output_opts 4 > /dev/null
+    if cmp -s <(sort output_opts_market_data.csv) <(sort output_4thread_market_data.csv); then
+        echo "   ✓ $opts matches default output"
+    else
+        echo "   ✗ $opts differs from default output!"
+    fi
+done
+
+# 6. 线程绑定和输入映射: 应正常退出, 结果排序后与不绑定的运行一致
+echo -e "\n6. Testing thread placement and input mapping..."
+for opts in "-a core" "-a node" "-P" "-H" "-a node -P -H"; do
+    if ./step_fast_parser $opts test_data.bin output_place 4 > /dev/null &&
+       cmp -s <(sort output_place_market_data.csv) <(sort output_4thread_market_data.csv); then
+        echo "   ✓ $opts matches unpinned output"
+    else
+        echo "   ✗ $opts failed or differs from unpinned output!"
+    fi
+done
+
+# 7. 批量模式
+echo -e "\n7. Testing batch mode..."
+rm -rf batch_data && mkdir batch_data
+for i in 1 2 3; do
+    ./step_fast_data_generator batch_data/capture_$i.bin $((i * 20000)) 5 > /dev/null
+done
+rm -f batch_data/*_expected.csv  # 生成器的校验文件不是输入
+
+./step_fast_parser batch_data batch_output 4 > /dev/null
+for i in 1 2 3; do
+    ./step_fast_parser batch_data/capture_$i.bin single_output_$i 1 > /dev/null
+    if cmp -s <(sort "batch_output_capture_${i}_market_data.csv") <(sort "single_output_${i}_market_data.csv"); then
+        echo "   ✓ capture_$i matches single-file output"
+    else
+        echo "   ✗ capture_$i differs from single-file output!"
+    fi
+done
+
+# 8. 按代码分区: 各代码文件合起来应与合并输出一致, 字典中的消息数之和等于总数
+echo -e "\n8. Testing per-symbol partitioning..."
+rm -rf sym_data && mkdir sym_data
+./step_fast_parser -S test_data.bin sym_data/sym 4 > /dev/null
+if cmp -s <(for f in sym_data/sym_*_market_data.csv; do tail -n +2 "$f"; done | sort) \
+          <(tail -n +2 output_1thread_market_data.csv | sort); then
+    echo "   ✓ Per-symbol files match merged output"
+else
+    echo "   ✗ Per-symbol files differ from merged output!"
+fi
+symbol_total=$(awk -F, 'NR > 1 { sum += $3 } END { print sum + 0 }' sym_data/sym_symbols.csv)
+if [ "$symbol_total" -eq "$(($(wc -l < output_1thread_market_data.csv) - 1))" ]; then
+    echo "   ✓ Symbol dictionary counts add up to $symbol_total messages"
+else
+    echo "   ✗ Symbol dictionary counts add up to $symbol_total messages!"
+fi
+
+# 9. A/B线路仲裁: 两条相同线路的结果应与单文件一致, 有缺口的线路互相补缺
+echo -e "\n9. Testing A/B arbitration..."
+rm -rf ab_data && mkdir ab_data
+cp test_data.bin ab_data/line_a.bin
+cp test_data.bin ab_data/line_b.bin
+./step_fast_parser -A ab_data ab_output 4 > /dev/null
+if cmp -s <(tail -n +2 ab_output_market_data.csv | sort) <(tail -n +2 output_1thread_market_data.csv | sort); then
+    echo "   ✓ Arbitrated output matches single-line output"
+else
+    echo "   ✗ Arbitrated output differs from single-line output!"
+fi
+if [ "$(wc -l < ab_output_gaps.csv)" -eq 1 ]; then
+    echo "   ✓ No gaps reported"
+else
+    echo "   ✗ Unexpected gaps reported!"
+fi
+
+# 构造有缺口的线路: A缺100-199, B缺150-249和1000, A末尾重传500-509
+# 按消息头魔数"PETS"定位每条消息的起始偏移, 第i个即序列号i
+LC_ALL=C grep -obUaP '\x50\x45\x54\x53' test_data.bin | cut -d: -f1 > ab_offsets.txt
+off() { sed -n "$(($1 + 1))p" ab_offsets.txt; }
+slice() { tail -c +$(($1 + 1)) test_data.bin | head -c $(($2 - $1)); }
+size=$(stat -c%s test_data.bin)
+rm -rf ab_gap_data && mkdir ab_gap_data
+{ slice 0 $(off 100); slice $(off 200) $size; slice $(off 500) $(off 510); } > ab_gap_data/line_a.bin
+{ slice 0 $(off 150); slice $(off 250) $(off 1000); slice $(off 1001) $size; } > ab_gap_data/line_b.bin
+./step_fast_parser -A ab_gap_data ab_gap_output 4 > /dev/null
+
+# 150-199两条线路都缺失, 其余与单线程输出逐行一致(单线程输出按序列号排列)
+if cmp -s ab_gap_output_market_data.csv <(sed '152,201d' output_1thread_market_data.csv); then
+    echo "   ✓ Gaps filled across lines, $(($(wc -l < ab_gap_output_market_data.csv) - 1)) rows in seq order"
+else
+    echo "   ✗ Arbitrated output with gaps is wrong!"
+fi
+expected_gaps="StartSeq,EndSeq,Count,MissingLines,SuppliedBy
+100,149,50,0,1
+150,199,50,0;1,none
+200,249,50,1,0
+1000,1000,1,1,0"
+if [ "$(cat ab_gap_output_gaps.csv)" = "$expected_gaps" ]; then
+    echo "   ✓ Gap report lists filled and unrecoverable gaps"
+else
+    echo "   ✗ Gap report differs!"
+    cat ab_gap_output_gaps.csv
+fi
+
+# 10. 性能测试
+echo -e "\n10. Performance test with large file..."
 echo "   Generating 500MB test file..."
 ./step_fast_data_generator large_test.bin 1000000 500
 